@@ -0,0 +1,74 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Throughput of the counts storages, std::vector and AdaptiveCounts:
+ * increments at precomputed random bins (the storage alone), and
+ * Histo::FillCounts (storage plus index search).
+ *
+ * Usage: bench_adaptive_counts [samples] [repetitions]
+ */
+#include "histo.hpp"
+#include "bench_common.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using namespace histo;
+
+template <typename TCounts>
+double IncrementSeconds(const std::vector<unsigned long int> &indices,
+                        const unsigned long int &bins, const int &repetitions) {
+    TCounts counts;
+    unsigned long int check = 0;
+    const double seconds = BestSeconds(repetitions, [&]() {
+        counts.assign(bins, 0);
+        for (const auto &i : indices)
+            counts[i]++;
+        check += counts[indices.front()];
+    });
+    if (check == 0)
+        std::cerr << "unexpected empty counts" << std::endl;
+    return seconds;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000000;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 3;
+    std::mt19937_64 gen(0);
+
+    for (const unsigned long int bins : {256ul, 65536ul, 4194304ul}) {
+        // Skewed data, most samples in few bins, like typical histograms.
+        std::normal_distribution<double> dist(bins / 2.0, bins / 16.0);
+        std::vector<double> data(samples);
+        std::vector<unsigned long int> indices(samples);
+        for (size_t s = 0; s < samples; ++s) {
+            data[s] = std::min(std::max(dist(gen), 0.0), bins - 0.5);
+            indices[s] = static_cast<unsigned long int>(data[s]);
+        }
+        const double vector_increment =
+                IncrementSeconds<std::vector<unsigned long int>>(indices, bins, repetitions);
+        const double adaptive_increment =
+                IncrementSeconds<AdaptiveCounts<unsigned long int>>(indices, bins, repetitions);
+
+        const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, bins, bins);
+        Histo<double> h_vector(std::vector<double>(), breaks);
+        Histo<double, unsigned long int, AdaptiveCounts> h_adaptive(std::vector<double>(), breaks);
+        const double vector_fill = BestSeconds(repetitions, [&]() {
+            h_vector.ResetCounts();
+            h_vector.FillCounts(data);
+        });
+        const double adaptive_fill = BestSeconds(repetitions, [&]() {
+            h_adaptive.ResetCounts();
+            h_adaptive.FillCounts(data);
+        });
+        std::cout << "bins: " << bins
+                  << ", increment Msamples/s vector: " << samples / vector_increment * 1e-6
+                  << ", adaptive: " << samples / adaptive_increment * 1e-6
+                  << " | FillCounts Msamples/s vector: " << samples / vector_fill * 1e-6
+                  << ", adaptive: " << samples / adaptive_fill * 1e-6 << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,26 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Helpers shared by the benchmarks.
+ */
+#ifndef HISTO_BENCH_COMMON_HPP_
+#define HISTO_BENCH_COMMON_HPP_
+#include <chrono>
+
+/** Best wall time in seconds of repetitions calls to f. */
+template <typename F>
+double BestSeconds(const int &repetitions, F f) {
+    double best = 0.0;
+    for (int r = 0; r < repetitions; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+        best = (r == 0 || seconds < best) ? seconds : best;
+    }
+    return best;
+}
+#endif
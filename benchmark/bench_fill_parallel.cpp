@@ -0,0 +1,71 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Throughput of FillCountsParallel using the cpus of 1, 2, ... NUMA nodes,
+ * compared to the serial FillCounts.
+ *
+ * Usage: bench_fill_parallel [samples] [bins] [repetitions]
+ *
+ * The samples are initialized in parallel with the same split and pinning
+ * than the fill over all the nodes, so their pages are placed by first
+ * touch in the node that reads them.
+ * Build with -DWITH_NUMA=ON to detect the nodes, test on a single node
+ * machine booting with numa=fake=2.
+ */
+#include "histo_parallel_fill.hpp"
+#include "bench_common.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+
+using namespace histo;
+
+int main(int argc, char *argv[]) {
+    const size_t samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000000;
+    const unsigned long int bins = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+    const int repetitions = argc > 3 ? std::atoi(argv[3]) : 5;
+
+    const auto topology = DetectNumaTopology();
+    std::cout << "nodes: " << topology.Nodes() << ", cpus: " << topology.Cpus()
+              << ", samples: " << samples << ", bins: " << bins << std::endl;
+
+    // First touch of the data with the split of the fill over all nodes.
+    std::unique_ptr<double[]> data(new double[samples]);
+    const unsigned int all_threads =
+            NumberOfThreads(static_cast<unsigned int>(topology.Cpus()), samples);
+    const auto thread_nodes = ThreadNodes(topology, all_threads);
+    const auto cpus = ThreadCpus(topology, thread_nodes);
+    const auto boundaries = PageAlignedChunks(data.get(), samples, all_threads);
+    ParallelForPinned(cpus, [&](const unsigned int &t) {
+        std::mt19937_64 gen(t);
+        std::uniform_real_distribution<double> dist(0.0, 1.0);
+        for (size_t i = boundaries[t]; i < boundaries[t + 1]; ++i)
+            data[i] = dist(gen);
+    });
+
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 1.0, bins);
+    Histo<double> h(std::vector<double>(), breaks);
+    const double serial = BestSeconds(repetitions, [&]() {
+        h.ResetCounts();
+        h.FillCounts(data.get(), samples);
+    });
+    std::cout << "serial: " << serial << " s, "
+              << samples / serial * 1e-6 << " Msamples/s" << std::endl;
+
+    for (size_t nodes = 1; nodes <= topology.Nodes(); ++nodes) {
+        const auto subset = topology.FirstNodes(nodes);
+        const double seconds = BestSeconds(repetitions, [&]() {
+            h.ResetCounts();
+            FillCountsParallel(h, data.get(), samples, 0, subset);
+        });
+        std::cout << "nodes: " << nodes << ", threads: " << subset.Cpus()
+                  << ": " << seconds << " s, "
+                  << samples / seconds * 1e-6 << " Msamples/s, speedup "
+                  << serial / seconds << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
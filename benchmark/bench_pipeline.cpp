@@ -0,0 +1,70 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Throughput of FillCountsFromFiles on gzip files of samples, compared to
+ * decompressing the same files without filling.
+ *
+ * Usage: bench_pipeline [samples_per_file] [files] [decompress_threads]
+ */
+#include "histo_pipeline.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using namespace histo;
+
+int main(int argc, char *argv[]) {
+    const size_t samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    const unsigned int files = argc > 2 ? std::atoi(argv[2]) : 2;
+    const unsigned int decompress_threads = argc > 3 ? std::atoi(argv[3]) : files;
+
+    std::vector<std::string> paths;
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> data(samples);
+    for (unsigned int f = 0; f < files; ++f) {
+        for (auto &v : data)
+            v = std::min(std::max(dist(gen), -5.0f), 5.0f);
+        paths.push_back("bench_pipeline_" + std::to_string(f) + ".gz");
+        gzFile file = gzopen(paths.back().c_str(), "wb1");
+        gzwrite(file, data.data(),
+                static_cast<unsigned int>(data.size() * sizeof(float)));
+        gzclose(file);
+    }
+    const double total = static_cast<double>(samples) * files;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<BlockSource>> sources;
+    for (const auto &path : paths)
+        sources.push_back(OpenBlockSource(path, GzipCompression));
+    ParallelForChunks(sources.size(), NumberOfThreads(decompress_threads, sources.size()),
+                      [&](const unsigned int &, const size_t &begin, const size_t &end) {
+                          std::vector<char> buffer(1 << 20);
+                          for (size_t s = begin; s < end; ++s)
+                              while (sources[s]->Read(buffer.data(), buffer.size())) {
+                              }
+                      });
+    const double decompress = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    std::cout << "decompress only: " << decompress << " s, "
+              << total / decompress * 1e-6 << " Msamples/s" << std::endl;
+
+    Histo<double> h(std::vector<float>(),
+                    GenerateBreaksFromRangeAndBins<double>(-5.0, 5.0, 256));
+    start = std::chrono::steady_clock::now();
+    FillCountsFromFiles<float>(h, paths, GzipCompression, decompress_threads);
+    const double pipeline = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    std::cout << "pipeline fill: " << pipeline << " s, "
+              << total / pipeline * 1e-6 << " Msamples/s, "
+              << decompress / pipeline * 100 << "% of decompression speed"
+              << std::endl;
+    for (const auto &path : paths)
+        std::remove(path.c_str());
+    return EXIT_SUCCESS;
+}
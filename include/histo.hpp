@@ -13,13 +13,19 @@ calculate and optimize breaks automatically. Accepts different precissions.
 #define HISTO_HPP_
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring> // std::memcpy
 #include <iomanip> // std::setw
 #include <iostream>
 #include <iterator> //iostream_iterator
+#include <limits>
+#include <mutex>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <numeric> // std::inner_product
+#include "histo_instrumentation.hpp"
 /** histo namespace in histo.h*/
 namespace histo {
 /** \defgroup breaks_methods breaks_methods */
@@ -33,6 +39,20 @@ enum breaks_method {
 };
 /** @} */
 
+/** \defgroup axis_growth axis_growth */
+/**@{
+ * @brief Behaviour of the axis when filling values out of range.
+ * FixedAxis = 0.
+ */
+enum axis_growth {
+    /** Values out of range throw histo_error. */
+    FixedAxis = 0,
+    /** Equidistant breaks extend to include values out of range.
+     * @sa Histo::SetAxisGrowth */
+    GrowingAxis
+};
+/** @} */
+
 /** \defgroup GenerateBreaks Generate breaks from data, range, and/or bins. */
 /** @{
  * @brief Help functions to manually creating breaks from input range
@@ -149,6 +169,771 @@ bool isequalthan(const TData &v1, const TData &v2) {
     return std::abs(v1 - v2) <= N * std::numeric_limits<TData>::epsilon();
 }
 
+/** \defgroup CountsStorage Storage backends for counts. */
+/** @{
+ * @brief Sparse storage for counts, for huge bin spaces with few occupied bins.
+ *
+ * Occupied bins are kept in an open-addressing hash table (linear probing),
+ * so memory and the cost of whole-histogram operations scale with the number
+ * of occupied bins instead of with the number of bins.
+ * When the occupancy crosses dense_threshold() (ratio of occupied bins over
+ * size()), the storage switches automatically to a dense std::vector.
+ *
+ * It mimics the parts of std::vector used by @sa Histo: size, resize,
+ * assign and operator[]. The non-const operator[] returns a @sa reference
+ * proxy, that inserts the bin only when a non-zero value is written to it,
+ * so reading bins never grows the storage.
+ *
+ * @tparam T type of the counts.
+ */
+template <typename T>
+class SparseCounts {
+  public:
+    using value_type = T;
+    using size_type = unsigned long int;
+
+    /** Proxy to a bin, reading it does not insert it. */
+    class reference {
+      public:
+        reference(SparseCounts *owner, const size_type &index)
+                : owner_(owner), index_(index){};
+        operator T() const { return owner_->Get(index_); };
+        reference &operator=(const T &v) {
+            owner_->Set(index_, v);
+            return *this;
+        };
+        reference &operator=(const reference &other) {
+            return *this = static_cast<T>(other);
+        };
+        reference &operator+=(const T &v) {
+            if (v != T(0))
+                owner_->Slot(index_) += v;
+            return *this;
+        };
+        reference &operator-=(const T &v) {
+            if (v != T(0))
+                owner_->Slot(index_) -= v;
+            return *this;
+        };
+        reference &operator++() {
+            ++owner_->Slot(index_);
+            return *this;
+        };
+        T operator++(int) { return owner_->Slot(index_)++; };
+        reference &operator--() { return *this -= 1; };
+        T operator--(int) { return owner_->Slot(index_)--; };
+
+      private:
+        SparseCounts *owner_;
+        size_type index_;
+    };
+
+    SparseCounts() = default;
+    explicit SparseCounts(const size_type &n) : size_(n){};
+
+    /** Number of bins, occupied or not. */
+    size_type size() const { return size_; };
+    /** Number of stored bins. Bins set to zero explicitly are included. */
+    size_type occupied() const {
+        return is_dense() ? static_cast<size_type>(std::count_if(
+                                    dense_.begin(), dense_.end(),
+                                    [](const T &c) { return c != T(0); }))
+                          : occupied_;
+    };
+    /** True if the storage has switched to a dense vector. */
+    bool is_dense() const { return dense_mode_; };
+    /** Occupancy ratio that triggers the switch to dense storage. */
+    double dense_threshold() const { return dense_threshold_; };
+    /** @brief Set the occupancy ratio that triggers the switch to dense. */
+    void set_dense_threshold(const double &threshold) {
+        dense_threshold_ = threshold;
+        if (!dense_mode_ && occupied_ > threshold * size_)
+            ConvertToDense();
+    };
+
+    /** @brief Change the number of bins, dropping bins >= n. */
+    void resize(const size_type &n) {
+        if (dense_mode_) {
+            dense_.resize(n);
+        } else if (n < size_) {
+            SparseCounts shrunk(n);
+            shrunk.dense_threshold_ = dense_threshold_;
+            for_each_occupied([&shrunk, &n](const size_type &i, const T &c) {
+                if (i < n)
+                    shrunk[i] = c;
+            });
+            *this = std::move(shrunk);
+            return;
+        }
+        size_ = n;
+    };
+
+    /** @brief Set n bins to value v. Back to sparse storage if v is zero. */
+    void assign(const size_type &n, const T &v) {
+        size_ = n;
+        keys_.clear();
+        values_.clear();
+        occupied_ = 0;
+        InvalidateOrder();
+        dense_mode_ = false;
+        dense_.clear();
+        dense_.shrink_to_fit();
+        if (v != T(0)) {
+            dense_mode_ = true;
+            dense_.assign(n, v);
+        }
+    };
+
+    T operator[](const size_type &index) const { return Get(index); };
+    reference operator[](const size_type &index) {
+        return reference(this, index);
+    };
+
+    /** @brief Value of a bin, zero if not occupied. Never inserts. */
+    T Get(const size_type &index) const {
+        if (dense_mode_)
+            return dense_[index];
+        if (keys_.empty())
+            return T(0);
+        const size_type slot = FindSlot(index);
+        return keys_[slot] == index ? values_[slot] : T(0);
+    };
+    /** @brief Set a bin, inserting it only if v is not zero. */
+    void Set(const size_type &index, const T &v) {
+        if (v == T(0) && Get(index) == T(0))
+            return;
+        Slot(index) = v;
+    };
+
+    /**
+     * @brief Call f(index, count) for each bin with non-zero count,
+     * in increasing order of index.
+     * The order of the occupied slots is sorted once, and reused until a bin
+     * is inserted.
+     */
+    template <typename F>
+    void for_each_occupied(F f) const {
+        if (dense_mode_) {
+            for (size_type i = 0; i < dense_.size(); ++i) {
+                if (dense_[i] != T(0))
+                    f(i, dense_[i]);
+            }
+            return;
+        }
+        const std::vector<size_type> &slots = SortedSlots();
+        for (const auto &s : slots) {
+            if (values_[s] != T(0))
+                f(keys_[s], values_[s]);
+        }
+    };
+
+  private:
+    /** Sorted slots, shared by const readers, reset by copies. */
+    struct OrderCache {
+        std::vector<size_type> slots;
+        bool valid{false};
+        std::mutex mutex;
+        OrderCache() = default;
+        OrderCache(const OrderCache &){};
+        OrderCache &operator=(const OrderCache &) {
+            slots.clear();
+            valid = false;
+            return *this;
+        };
+    };
+    const std::vector<size_type> &SortedSlots() const {
+        std::lock_guard<std::mutex> lock(order_.mutex);
+        if (!order_.valid) {
+            order_.slots.clear();
+            order_.slots.reserve(occupied_);
+            for (size_type s = 0; s < keys_.size(); ++s) {
+                if (keys_[s] != empty_key)
+                    order_.slots.push_back(s);
+            }
+            std::sort(order_.slots.begin(), order_.slots.end(),
+                      [this](const size_type &a, const size_type &b) {
+                          return keys_[a] < keys_[b];
+                      });
+            order_.valid = true;
+        }
+        return order_.slots;
+    };
+    void InvalidateOrder() { order_.valid = false; };
+    /** Storage of a bin, inserting it if it was not occupied. */
+    T &Slot(const size_type &index) {
+        if (dense_mode_)
+            return dense_[index];
+        if (!keys_.empty()) {
+            const size_type slot = FindSlot(index);
+            if (keys_[slot] == index)
+                return values_[slot];
+        }
+        if (occupied_ + 1 > dense_threshold_ * size_) {
+            ConvertToDense();
+            return dense_[index];
+        }
+        // Keep load factor <= 0.5, linear probing degrades quickly above it.
+        if (2 * (occupied_ + 1) > keys_.size())
+            Rehash(std::max<size_type>(16, 2 * keys_.size()));
+        const size_type slot = FindSlot(index);
+        keys_[slot] = index;
+        values_[slot] = T(0);
+        ++occupied_;
+        InvalidateOrder();
+        return values_[slot];
+    };
+    static constexpr size_type empty_key =
+            std::numeric_limits<size_type>::max();
+    /** Slot holding index, or the first empty slot where it would go. */
+    size_type FindSlot(const size_type &index) const {
+        const size_type mask = keys_.size() - 1;
+        // Fibonacci hashing spreads consecutive bin indices over the table.
+        size_type slot = static_cast<size_type>(
+                                 (static_cast<unsigned long long>(index) *
+                                  11400714819323198485ull) >>
+                                 hash_shift_) &
+                         mask;
+        while (keys_[slot] != empty_key && keys_[slot] != index) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    };
+    void Rehash(const size_type &capacity) {
+        InvalidateOrder();
+        std::vector<size_type> old_keys(capacity, empty_key);
+        std::vector<T> old_values(capacity);
+        old_keys.swap(keys_);
+        old_values.swap(values_);
+        hash_shift_ = 64;
+        for (size_type c = capacity; c > 1; c >>= 1) {
+            --hash_shift_;
+        }
+        for (size_type s = 0; s < old_keys.size(); ++s) {
+            if (old_keys[s] == empty_key)
+                continue;
+            const size_type slot = FindSlot(old_keys[s]);
+            keys_[slot] = old_keys[s];
+            values_[slot] = old_values[s];
+        }
+    };
+    void ConvertToDense() {
+        InvalidateOrder();
+        dense_.assign(size_, T(0));
+        for (size_type s = 0; s < keys_.size(); ++s) {
+            if (keys_[s] != empty_key)
+                dense_[keys_[s]] = values_[s];
+        }
+        keys_.clear();
+        keys_.shrink_to_fit();
+        values_.clear();
+        values_.shrink_to_fit();
+        occupied_ = 0;
+        dense_mode_ = true;
+    };
+
+    size_type size_{0};
+    size_type occupied_{0};
+    unsigned int hash_shift_{64};
+    /** Hash table slots, structure of arrays. */
+    std::vector<size_type> keys_;
+    std::vector<T> values_;
+    bool dense_mode_{false};
+    std::vector<T> dense_;
+    /** A sparse bin costs ~4 times a dense one (key, value, load factor). */
+    double dense_threshold_{0.25};
+    mutable OrderCache order_;
+};
+template <typename T>
+constexpr typename SparseCounts<T>::size_type SparseCounts<T>::empty_key;
+
+/**
+ * @brief Call f(index, count) for the bins of a counts container.
+ * Dense containers visit every bin, sparse containers only the occupied ones.
+ * Bins are visited in increasing order of index.
+ */
+template <typename T, typename Alloc, typename F>
+void ForEachCount(const std::vector<T, Alloc> &counts, F f) {
+    for (unsigned long int i = 0; i < counts.size(); ++i) {
+        f(i, counts[i]);
+    }
+}
+/** @brief @sa ForEachCount() */
+template <typename T, typename F>
+void ForEachCount(const SparseCounts<T> &counts, F f) {
+    counts.for_each_occupied(f);
+}
+
+/**
+ * @brief True for storages that only keep the occupied bins. The parallel
+ * and pipelined fills use a single writer for them, dense partials of every
+ * thread would defeat the sparse storage. @sa SparseCounts
+ */
+template <typename CountsType>
+struct IsSparseStorage : std::false_type {};
+template <typename T>
+struct IsSparseStorage<SparseCounts<T>> : std::true_type {};
+
+/**
+ * @brief Dense storage for counts where each page of counters starts with
+ * 8 bits and is promoted to 16, 32 and 64 bits (up to sizeof(T)) when one of
+ * its counters would overflow.
+ *
+ * Typical histograms have small counts in most bins, so the counts take
+ * up to sizeof(T) times less memory, and no count is ever lost before
+ * reaching std::numeric_limits<T>::max().
+ *
+ * It trades fill speed for memory: each increment pays a page lookup and a
+ * width dispatch, and is slower than std::vector, also when the dense
+ * counts do not fit in cache. Measure with bench_adaptive_counts.
+ *
+ * The non-const operator[] returns a @sa reference proxy, that supports
+ * the usual assignment, increment and decrement operators.
+ * Floating point counts (i.e from NormalizeByArea) are not adaptive, and are
+ * stored in a std::vector.
+ *
+ * @tparam T logical type of the counts, unsigned integer.
+ */
+template <typename T, typename = void>
+class AdaptiveCounts {
+    static_assert(std::is_unsigned<T>::value,
+                  "AdaptiveCounts requires unsigned counts.");
+
+  public:
+    using value_type = T;
+    using size_type = unsigned long int;
+    /** Number of counters sharing the same width. */
+    static constexpr size_type page_size = 4096;
+
+    /** Proxy to a counter, promoting its page when needed. */
+    class reference {
+      public:
+        reference(AdaptiveCounts *owner, const size_type &index)
+                : owner_(owner), index_(index){};
+        operator T() const { return owner_->Get(index_); };
+        reference &operator=(const T &v) {
+            owner_->Set(index_, v);
+            return *this;
+        };
+        reference &operator=(const reference &other) {
+            return *this = static_cast<T>(other);
+        };
+        reference &operator+=(const T &v) {
+            owner_->Set(index_, owner_->Get(index_) + v);
+            return *this;
+        };
+        reference &operator-=(const T &v) {
+            owner_->Set(index_, owner_->Get(index_) - v);
+            return *this;
+        };
+        reference &operator++() {
+            owner_->Increment(index_);
+            return *this;
+        };
+        T operator++(int) {
+            const T old = *this;
+            owner_->Increment(index_);
+            return old;
+        };
+        reference &operator--() { return *this -= 1; };
+        T operator--(int) {
+            const T old = *this;
+            *this -= 1;
+            return old;
+        };
+
+      private:
+        AdaptiveCounts *owner_;
+        size_type index_;
+    };
+
+    AdaptiveCounts() = default;
+    explicit AdaptiveCounts(const size_type &n) { assign(n, T(0)); };
+
+    size_type size() const { return size_; };
+    /** @brief Change the number of bins, new bins are set to zero. */
+    void resize(const size_type &n) {
+        const size_type old_pages = pages_.size();
+        pages_.resize((n + page_size - 1) / page_size);
+        for (size_type p = old_pages; p < pages_.size(); ++p) {
+            pages_[p].Allocate(page_size);
+        }
+        // Counters left behind by a previous shrink.
+        for (size_type i = size_; i < std::min(n, old_pages * page_size); ++i) {
+            Set(i, T(0));
+        }
+        size_ = n;
+    };
+    /** @brief Set n bins to value v, pages start with the width fitting v. */
+    void assign(const size_type &n, const T &v) {
+        pages_.assign((n + page_size - 1) / page_size, Page());
+        size_ = n;
+        const unsigned int level = LevelFor(v);
+        for (auto &p : pages_) {
+            p.level = level;
+            p.Allocate(page_size);
+            for (size_type off = 0; off < page_size; ++off) {
+                p.Set(off, v);
+            }
+        }
+    };
+
+    T operator[](const size_type &index) const { return Get(index); };
+    reference operator[](const size_type &index) {
+        return reference(this, index);
+    };
+
+    /** Width in bytes of the counters of the page holding index. */
+    unsigned int width(const size_type &index) const {
+        return 1u << pages_[index / page_size].level;
+    };
+
+  private:
+    static constexpr unsigned int MaxLevel() {
+        return sizeof(T) >= 8 ? 3 : sizeof(T) >= 4 ? 2 : sizeof(T) >= 2 ? 1 : 0;
+    };
+    static unsigned int LevelFor(const T &v) {
+        return v <= std::numeric_limits<std::uint8_t>::max()
+                       ? 0
+                       : v <= std::numeric_limits<std::uint16_t>::max()
+                                 ? 1
+                                 : v <= std::numeric_limits<std::uint32_t>::max()
+                                           ? 2
+                                           : 3;
+    };
+
+    struct Page {
+        unsigned int level{0};
+        std::vector<std::uint8_t> c8;
+        std::vector<std::uint16_t> c16;
+        std::vector<std::uint32_t> c32;
+        std::vector<std::uint64_t> c64;
+
+        void Allocate(const size_type &n) {
+            switch (level) {
+            case 0: c8.resize(n); break;
+            case 1: c16.resize(n); break;
+            case 2: c32.resize(n); break;
+            default: c64.resize(n); break;
+            }
+        };
+        T Get(const size_type &off) const {
+            switch (level) {
+            case 0: return c8[off];
+            case 1: return c16[off];
+            case 2: return static_cast<T>(c32[off]);
+            default: return static_cast<T>(c64[off]);
+            }
+        };
+        void Set(const size_type &off, const T &v) {
+            switch (level) {
+            case 0: c8[off] = static_cast<std::uint8_t>(v); break;
+            case 1: c16[off] = static_cast<std::uint16_t>(v); break;
+            case 2: c32[off] = static_cast<std::uint32_t>(v); break;
+            default: c64[off] = static_cast<std::uint64_t>(v); break;
+            }
+        };
+        /** @return false if the counter is at the maximum of its width. */
+        bool TryIncrement(const size_type &off) {
+            switch (level) {
+            case 0:
+                if (c8[off] == std::numeric_limits<std::uint8_t>::max())
+                    return false;
+                ++c8[off];
+                return true;
+            case 1:
+                if (c16[off] == std::numeric_limits<std::uint16_t>::max())
+                    return false;
+                ++c16[off];
+                return true;
+            case 2:
+                if (c32[off] == std::numeric_limits<std::uint32_t>::max())
+                    return false;
+                ++c32[off];
+                return true;
+            default: ++c64[off]; return true;
+            }
+        };
+        void Promote(const unsigned int &new_level) {
+            const size_type n = std::max(
+                    std::max(c8.size(), c16.size()),
+                    std::max(c32.size(), c64.size()));
+            std::vector<T> values(n);
+            for (size_type off = 0; off < n; ++off) {
+                values[off] = Get(off);
+            }
+            c8.clear(); c8.shrink_to_fit();
+            c16.clear(); c16.shrink_to_fit();
+            c32.clear(); c32.shrink_to_fit();
+            c64.clear(); c64.shrink_to_fit();
+            level = new_level;
+            Allocate(n);
+            for (size_type off = 0; off < n; ++off) {
+                Set(off, values[off]);
+            }
+        };
+    };
+
+    T Get(const size_type &index) const {
+        return pages_[index / page_size].Get(index & (page_size - 1));
+    };
+    void Set(const size_type &index, const T &v) {
+        Page &p = pages_[index / page_size];
+        const unsigned int needed = std::min(LevelFor(v), MaxLevel());
+        if (needed > p.level)
+            p.Promote(needed);
+        p.Set(index & (page_size - 1), v);
+    };
+    void Increment(const size_type &index) {
+        Page &p = pages_[index / page_size];
+        const size_type off = index & (page_size - 1);
+        if (p.TryIncrement(off))
+            return;
+        if (p.level < MaxLevel()) {
+            p.Promote(p.level + 1);
+            p.TryIncrement(off);
+        } else {
+            // Wrap around, as std::vector would. @sa Histo::Increase checks it.
+            p.Set(off, T(0));
+        }
+    };
+
+    size_type size_{0};
+    std::vector<Page> pages_;
+};
+template <typename T, typename Enable>
+constexpr typename AdaptiveCounts<T, Enable>::size_type
+        AdaptiveCounts<T, Enable>::page_size;
+
+/** @brief Floating point counts are stored in a plain std::vector. */
+template <typename T>
+class AdaptiveCounts<
+        T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+        : public std::vector<T> {
+  public:
+    using std::vector<T>::vector;
+};
+
+/** @brief @sa ForEachCount() */
+template <typename T, typename F>
+void ForEachCount(const AdaptiveCounts<T> &counts, F f) {
+    for (unsigned long int i = 0; i < counts.size(); ++i) {
+        f(i, counts[i]);
+    }
+}
+/** @} */
+
+/**
+ * @brief Check if all the bins of breaks have the same width.
+ * Soft comparisson, with a tolerance of 100 epsilons.
+ */
+template <typename PRECI>
+bool AreBreaksEquidistant(const std::vector<PRECI> &input_breaks) {
+    PRECI diff = input_breaks[1] - input_breaks[0];
+    for (auto it = input_breaks.begin() + 1, it_end = input_breaks.end();
+         it != it_end; it++) {
+        if (!isequalthan<PRECI, 100>(*it - *(it - 1), diff))
+            return false;
+    }
+    return true;
+}
+
+/** \defgroup Masks Masks to fill only some elements of data */
+/** @{
+ * @brief Selection of the elements of data to fill, without copying them.
+ * Masks are visited with ForEachSelected(mask, begin, end, f), that calls
+ * f(i) for each selected index i in [begin, end), in increasing order.
+ * Supported masks:
+ * - const unsigned char * or std::vector<unsigned char>: byte mask,
+ *   element i is selected if mask[i] != 0.
+ * - @sa BitMask: bit i % 64 of words[i / 64] selects element i.
+ * - @sa IndexRanges: half-open [first, second) ranges of selected indices.
+ * - @sa AllSelected: no mask.
+ */
+/** Bit mask, bit i % 64 of words[i / 64] (least significant first). */
+struct BitMask {
+    const std::uint64_t *words{nullptr};
+};
+/** Ranges [first, second) of selected indices, sorted and not overlapping.
+ * Adjacent ranges are allowed. */
+using IndexRanges = std::vector<std::pair<size_t, size_t>>;
+/** All the elements are selected. */
+struct AllSelected {};
+
+/** @brief Index of the lowest set bit of a non-zero word. */
+inline unsigned int CountTrailingZeros(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned int>(__builtin_ctzll(word));
+#else
+    unsigned int zeros = 0;
+    while (!(word & 1u)) {
+        word >>= 1;
+        ++zeros;
+    }
+    return zeros;
+#endif
+}
+
+/** @brief @sa Masks */
+template <typename F>
+void ForEachSelected(const AllSelected &, const size_t &begin,
+                     const size_t &end, F f) {
+    for (size_t i = begin; i < end; ++i)
+        f(i);
+}
+/** @brief Blocks of 8 unselected bytes are skipped with one comparison. */
+template <typename F>
+void ForEachSelected(const unsigned char *mask, const size_t &begin,
+                     const size_t &end, F f) {
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        std::uint64_t block;
+        std::memcpy(&block, mask + i, sizeof(block));
+        if (!block)
+            continue;
+        for (size_t j = i; j < i + 8; ++j) {
+            if (mask[j])
+                f(j);
+        }
+    }
+    for (; i < end; ++i) {
+        if (mask[i])
+            f(i);
+    }
+}
+/** @brief @sa Masks */
+template <typename F>
+void ForEachSelected(const std::vector<unsigned char> &mask,
+                     const size_t &begin, const size_t &end, F f) {
+    ForEachSelected(mask.data(), begin, end, f);
+}
+/** @brief Words without selected bits are skipped, full words are visited
+ * without testing bits, other words visit only their set bits. */
+template <typename F>
+void ForEachSelected(const BitMask &mask, const size_t &begin,
+                     const size_t &end, F f) {
+    size_t i = begin;
+    while (i < end) {
+        const size_t word_end = std::min(end, (i / 64 + 1) * 64);
+        const size_t width = word_end - i;
+        std::uint64_t word = mask.words[i / 64] >> (i % 64);
+        if (width < 64)
+            word &= (std::uint64_t(1) << width) - 1;
+        if (word == ~std::uint64_t(0)) {
+            for (size_t j = i; j < word_end; ++j)
+                f(j);
+        } else {
+            while (word) {
+                f(i + CountTrailingZeros(word));
+                word &= word - 1;
+            }
+        }
+        i = word_end;
+    }
+}
+/** @brief Ranges are clipped to [begin, end). */
+template <typename F>
+void ForEachSelected(const IndexRanges &ranges, const size_t &begin,
+                     const size_t &end, F f) {
+    for (const auto &r : ranges) {
+        const size_t first = std::max(r.first, begin);
+        const size_t second = std::min(r.second, end);
+        for (size_t i = first; i < second; ++i)
+            f(i);
+    }
+}
+
+/** @brief Throw if the mask cannot select from n elements. */
+inline void CheckMask(const std::vector<unsigned char> &mask, const size_t &n) {
+    if (mask.size() != n)
+        throw histo_error("CheckMask: mask and data have different sizes");
+}
+/** @brief @sa CheckMask. Unsorted or overlapping ranges would select
+ * some indices twice. */
+inline void CheckMask(const IndexRanges &ranges, const size_t &n) {
+    size_t previous_end = 0;
+    for (const auto &r : ranges) {
+        if (r.first > r.second || r.second > n)
+            throw histo_error("CheckMask: invalid range [" +
+                              std::to_string(r.first) + ", " +
+                              std::to_string(r.second) + ")");
+        if (r.first < previous_end)
+            throw histo_error("CheckMask: range [" +
+                              std::to_string(r.first) + ", " +
+                              std::to_string(r.second) +
+                              ") is not sorted or overlaps the previous one");
+        previous_end = r.second;
+    }
+}
+/** @brief Masks from pointers cannot be checked. */
+template <typename TMask>
+void CheckMask(const TMask &, const size_t &) {}
+/** @} */
+
+/**
+ * @brief Return the index of the bin of breaks associated to the input value.
+ * The right border is included in the last bin.
+ *
+ * @param breaks monotonically increasing breaks.
+ * @param value Ranging from breaks.front() to breaks.back()
+ * @return Index of the bin, between 0 and breaks.size() - 2
+ */
+template <typename PRECI, typename TData>
+unsigned long int IndexFromBreaks(const std::vector<PRECI> &breaks,
+                                  const TData &value) {
+    // We could use this with a custom comparator:
+    // typename std::vector<T>::iterator low =
+    // std::lower_bound(breaks.begin(), breaks.end(), value);
+    unsigned long int lo{0}, hi{breaks.size() - 1},
+            newb; // include right border in the last bin.
+    if (value >= breaks[lo] &&
+        (value < breaks[hi] ||
+         histo::isequalthan<PRECI>(value, breaks[hi]))) {
+        while (hi - lo >= 2) {
+            newb = (hi + lo) / 2;
+            if ((value >= breaks[newb]))
+                lo = newb;
+            else
+                hi = newb;
+        }
+    } else {
+        HISTO_INSTRUMENT(RecordOutOfRange(value));
+        throw histo_error(" IndexFromValue: " + std::to_string(value) +
+                          " is out of bonds");
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Index of the bin of value in O(1), for equidistant breaks.
+ * The bin is estimated with (value - breaks[0]) * inv_width and corrected
+ * against its neighbour breaks, so it is the same bin as
+ * @sa IndexFromBreaks, also for values exactly on a break.
+ * The range of value is not checked.
+ *
+ * @param breaks equidistant breaks, @sa AreBreaksEquidistant
+ * @param inv_width bins / (breaks.back() - breaks.front())
+ * @param value in [breaks.front(), breaks.back()]
+ * @return Index of the bin, between 0 and breaks.size() - 2
+ */
+template <typename PRECI, typename TData>
+unsigned long int IndexFromEquidistantBreaks(const std::vector<PRECI> &breaks,
+                                             const PRECI &inv_width,
+                                             const TData &value) {
+    const unsigned long int last = breaks.size() - 2;
+    const PRECI position = (value - breaks[0]) * inv_width;
+    unsigned long int i = 0;
+    if (position > 0)
+        i = position < static_cast<PRECI>(last)
+                    ? static_cast<unsigned long int>(position)
+                    : last;
+    while (i > 0 && value < breaks[i])
+        --i;
+    while (i < last && !(value < breaks[i + 1]))
+        ++i;
+    return i;
+}
+
 /**
  * @brief Histogram inspired by R.
  * Simple, no dependancies, header-only.
@@ -157,12 +942,15 @@ bool isequalthan(const TData &v1, const TData &v2) {
 //  * @tparam T Input data type.
  * @tparam PRECI It should be equal to T, except when T is int.
  * @tparam PRECI_INTEGER int type for counts data member.
+ * @tparam COUNTS_CONTAINER storage for counts, std::vector (dense),
+ * @sa SparseCounts or @sa AdaptiveCounts.
  */
-template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int>
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
 struct Histo {
     using BreaksType = std::vector<PRECI>;
     using RangeType = std::pair<PRECI, PRECI>;
-    using CountsType = std::vector<PRECI_INTEGER>;
+    using CountsType = COUNTS_CONTAINER<PRECI_INTEGER>;
     /************* DATA *****************/
     /** Low and upper limit for breaks. */
     RangeType range;
@@ -175,6 +963,11 @@ struct Histo {
     CountsType counts;
     /** name/description of the histogram */
     std::string name;
+    /** Behaviour of FillCounts with values out of range. */
+    axis_growth growth{FixedAxis};
+    /** With GrowingAxis, maximum number of bins before merging pairs of
+     * bins. 0 for no limit. */
+    unsigned long int max_bins{0};
 
     /********** CONSTRUCTORS ************/
     Histo() = default;
@@ -187,9 +980,12 @@ struct Histo {
      */
     template <typename TData>
     Histo(const std::vector<TData> &data, histo::breaks_method method = Scott) {
-        auto range_ptr = std::minmax_element(data.begin(), data.end());
-        range = std::make_pair(static_cast<PRECI>(*range_ptr.first),
-                               static_cast<PRECI>(*range_ptr.second));
+        {
+            HISTO_INSTRUMENT_PHASE(MinMaxPhase);
+            auto range_ptr = std::minmax_element(data.begin(), data.end());
+            range = std::make_pair(static_cast<PRECI>(*range_ptr.first),
+                                   static_cast<PRECI>(*range_ptr.second));
+        }
         breaks = CalculateBreaks(data, range, method);
         bins = static_cast<decltype(bins)>(breaks.size() - 1);
         ResetCounts();
@@ -233,16 +1029,21 @@ struct Histo {
     };
 
     /********* PUBLIC METHODS ***********/
+    /** @brief Center of the bin with input index. */
+    PRECI ComputeBinCenter(const unsigned long int &index) const {
+        double break_width = (this->breaks[index + 1] - this->breaks[index]) / 2.0;
+        return this->breaks[index] + break_width;
+    }
     BreaksType ComputeBinCenters() const {
         BreaksType centers(this->counts.size());
         for (unsigned long long i = 0; i < this->counts.size(); i++) {
-            double break_width = (this->breaks[i + 1] - this->breaks[i]) / 2.0;
-            centers[i] = this->breaks[i] + break_width;
+            centers[i] = ComputeBinCenter(i);
         }
         return centers;
     }
     /**
      * @brief print to input std::ostream breaks and counts
+     * With sparse storage, only occupied bins are printed.
      *
      * @param os input ostream, std::cout, std::ofstream, etc.
      */
@@ -250,7 +1051,8 @@ struct Histo {
         std::ios::fmtflags os_flags(os.flags());
         os.setf(std::ios_base::fixed, std::ios_base::floatfield);
         os.precision(9);
-        for (unsigned long long i = 0; i < this->counts.size(); i++) {
+        ForEachCount(this->counts, [this, &os](const unsigned long int &i,
+                                               const PRECI_INTEGER &c) {
             os << "[";
             os << std::setw(18) << this->breaks[i] << "," << std::setw(18)
                << this->breaks[i + 1];
@@ -258,13 +1060,14 @@ struct Histo {
                 os << "]";
             else
                 os << ")";
-            os << " " << std::setw(18) << this->counts[i] << std::endl;
-        }
+            os << " " << std::setw(18) << c << std::endl;
+        });
         os.flags(os_flags);
     }
 
     /**
      * @brief print to input std::ostream center of bins and counts
+     * With sparse storage, only occupied bins are printed.
      *
      * @param os input ostream, std::cout, std::ofstream, etc.
      */
@@ -272,11 +1075,11 @@ struct Histo {
         std::ios::fmtflags os_flags(os.flags());
         os.setf(std::ios_base::fixed, std::ios_base::floatfield);
         os.precision(9);
-        auto centers = this->ComputeBinCenters();
-        for (unsigned long long i = 0; i < this->counts.size(); i++) {
-            os << std::setw(18) << centers[i] << " " << std::setw(18)
-               << this->counts[i] << std::endl;
-        }
+        ForEachCount(this->counts, [this, &os](const unsigned long int &i,
+                                               const PRECI_INTEGER &c) {
+            os << std::setw(18) << this->ComputeBinCenter(i) << " "
+               << std::setw(18) << c << std::endl;
+        });
         os.flags(os_flags);
     }
 
@@ -303,12 +1106,16 @@ struct Histo {
         os << std::endl;
     }
 
+    /** With sparse storage, only counts of occupied bins are printed. */
     void PrintCounts(std::ostream &os) const {
-        for (size_t i = 0; i < this->counts.size(); i++) {
-            os << std::setw(18) << this->counts[i];
-            if (i != this->counts.size() - 1)
+        bool first = true;
+        ForEachCount(this->counts, [&os, &first](const unsigned long int &,
+                                                 const PRECI_INTEGER &c) {
+            if (!first)
                 os << " ";
-        }
+            os << std::setw(18) << c;
+            first = false;
+        });
         os << std::endl;
     }
     /**
@@ -319,35 +1126,12 @@ struct Histo {
      */
     template <typename TData>
     unsigned long int IndexFromValue(const TData &value) const {
-        // We could use this with a custom comparator:
-        // typename std::vector<T>::iterator low =
-        // std::lower_bound(breaks.begin(), breaks.end(), value);
-        unsigned long int lo{0}, hi{bins},
-                newb; // include right border in the last bin.
-        if (value >= breaks[lo] &&
-            (value < breaks[hi] ||
-             histo::isequalthan<PRECI>(value, breaks[hi]))) {
-            while (hi - lo >= 2) {
-                newb = (hi + lo) / 2;
-                if ((value >= breaks[newb]))
-                    lo = newb;
-                else
-                    hi = newb;
-            }
-        } else {
-            throw histo_error(" IndexFromValue: " + std::to_string(value) +
-                              " is out of bonds");
-        }
-
-        return lo;
+        return IndexFromBreaks(breaks, value);
     };
 
     /** @brief Resize counts and reset value to zero. */
     void ResetCounts() {
-        counts.resize(bins);
-        for (auto &c : counts) {
-            c = 0;
-        }
+        counts.assign(bins, PRECI_INTEGER(0));
     };
     /**
      * @brief Fill counts from data.
@@ -359,25 +1143,163 @@ struct Histo {
      */
     template <typename TData>
     CountsType &FillCounts(const std::vector<TData> &data) {
-        for (auto &v : data) {
-            counts[IndexFromValue(v)]++;
+        return FillCounts(data.data(), data.size());
+    };
+    /** @brief @sa FillCounts, from n values of data. */
+    template <typename TData>
+    CountsType &FillCounts(const TData *data, const size_t &n) {
+        HISTO_INSTRUMENT_PHASE(FillCountsPhase);
+        HISTO_INSTRUMENT(RecordSamples(SearchIndexPath, n));
+        if (growth == GrowingAxis) {
+            for (size_t i = 0; i < n; ++i) {
+                GrowToInclude(data[i]);
+                counts[IndexFromValue(data[i])]++;
+            }
+            return counts;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            counts[IndexFromValue(data[i])]++;
         }
         return counts;
     };
 
+    /**
+     * @brief Fill counts only from the elements of data selected by mask,
+     * without copying them. @sa Masks
+     *
+     * @param data values.
+     * @param n number of values.
+     * @param mask byte mask, @sa BitMask, @sa IndexRanges.
+     *
+     * @return Reference to the data member @sa counts
+     */
+    template <typename TData, typename TMask>
+    CountsType &FillCountsMasked(const TData *data, const size_t &n,
+                                 const TMask &mask) {
+        HISTO_INSTRUMENT_PHASE(FillCountsPhase);
+        CheckMask(mask, n);
+        HISTO_INSTRUMENT(unsigned long long selected = 0);
+        ForEachSelected(mask, 0, n, [&](const size_t &i) {
+            if (growth == GrowingAxis)
+                GrowToInclude(data[i]);
+            counts[IndexFromValue(data[i])]++;
+            HISTO_INSTRUMENT(++selected);
+        });
+        HISTO_INSTRUMENT(RecordSamples(SearchIndexPath, selected));
+        return counts;
+    };
+    /** @brief @sa FillCountsMasked */
+    template <typename TData, typename TMask>
+    CountsType &FillCountsMasked(const std::vector<TData> &data,
+                                 const TMask &mask) {
+        return FillCountsMasked(data.data(), data.size(), mask);
+    };
+
+    /** \defgroup AxisGrowth Auto-growing axis */
+    /** @{
+     * @brief Let FillCounts extend the axis to include values out of range,
+     * instead of throwing. Breaks must be equidistant.
+     *
+     * The axis is extended appending empty bins at the end closer to the
+     * value, at least doubling the number of bins so the cost of moving
+     * counts is amortized. When the number of bins would exceed
+     * input_max_bins, pairs of adjacent bins are merged instead, doubling
+     * the width. Counts are always preserved exactly.
+     *
+     * @param input_growth @sa histo::axis_growth
+     * @param input_max_bins maximum number of bins, 0 for no limit.
+     */
+    void SetAxisGrowth(const axis_growth &input_growth,
+                       const unsigned long int &input_max_bins = 0) {
+        if (input_growth == GrowingAxis &&
+            !CheckBreaksAreEquidistant(breaks))
+            throw histo_error("SetAxisGrowth: GrowingAxis requires "
+                              "equidistant breaks");
+        // Merging keeps the low edge, a single bin could never move it.
+        if (input_growth == GrowingAxis && input_max_bins == 1)
+            throw histo_error("SetAxisGrowth: max_bins must be 0 (no limit) "
+                              "or at least 2");
+        growth = input_growth;
+        max_bins = input_max_bins;
+        if (growth == GrowingAxis && max_bins != 0) {
+            while (bins > max_bins) {
+                MergeBinPairs();
+            }
+        }
+    };
+
+    /**
+     * @brief Extend the equidistant breaks until value is in range.
+     * @sa SetAxisGrowth
+     *
+     * @return true if the axis changed.
+     */
+    template <typename TData>
+    bool GrowToInclude(const TData &value) {
+        if (IsInRange(value))
+            return false;
+        HISTO_INSTRUMENT(RecordOutOfRange(value));
+        if (!std::isfinite(static_cast<double>(value)))
+            throw histo_error("GrowToInclude: value is not finite: " +
+                              std::to_string(value));
+        // Bins that can be added without overflowing the bin count.
+        const double max_needed = static_cast<double>(
+                std::numeric_limits<unsigned long int>::max() / 4);
+        while (!IsInRange(value)) {
+            const PRECI width = breaks[1] - breaks[0];
+            const bool below = value < breaks[0];
+            const PRECI distance = below ? breaks[0] - value
+                                         : value - breaks[bins];
+            const double steps = std::floor(static_cast<double>(distance) /
+                                            static_cast<double>(width)) + 1;
+            if (!(steps < max_needed)) {
+                if (max_bins == 0)
+                    throw histo_error("GrowToInclude: value " +
+                                      std::to_string(value) +
+                                      " is too far from the axis");
+                MergeBinPairs();
+                continue;
+            }
+            const unsigned long int needed =
+                    static_cast<unsigned long int>(steps);
+            unsigned long int extension = std::max(needed, bins);
+            if (max_bins != 0 && bins + extension > max_bins) {
+                if (bins + needed > max_bins) {
+                    MergeBinPairs();
+                    continue;
+                }
+                extension = max_bins - bins;
+            }
+            if (below)
+                ExtendBins(extension, 0);
+            else
+                ExtendBins(0, extension);
+        }
+        return true;
+    };
+    /** @} */
+
     /** \defgroup CountsManipulation Counts Safe Manipulation */
     /** @{
+     * @brief Count of a bin, read through the const counts so sparse
+     * storage does not insert it.
+     */
+    PRECI_INTEGER GetCount(const unsigned long int &index) const {
+        return counts[index];
+    };
+    /**
      * @brief Increase count by one, checking if exceeds
      * std::numeric_limits<PRECI_INTEGER>::max().
      *
      * @param index of counts
      */
     void Increase(const unsigned long int &index) {
-        if (counts[index] == std::numeric_limits<PRECI_INTEGER>::max())
+        const PRECI_INTEGER current = GetCount(index);
+        if (current == std::numeric_limits<PRECI_INTEGER>::max())
             throw histo_error("Increase has exceded PRECI_INTEGER."
                               " Index: " +
                               std::to_string(index) +
-                              " Value: " + std::to_string(counts[index]));
+                              " Value: " + std::to_string(current));
         counts[index]++;
     };
 
@@ -385,11 +1307,12 @@ struct Histo {
      * @param index of counts.
      */
     void Decrease(const unsigned long int &index) {
-        if (counts[index] <= 0)
+        const PRECI_INTEGER current = GetCount(index);
+        if (current <= 0)
             throw histo_error("Decrease has reached negative value."
                               " Index: " +
                               std::to_string(index) +
-                              " Value: " + std::to_string(counts[index]));
+                              " Value: " + std::to_string(current));
         counts[index]--;
     };
 
@@ -398,7 +1321,7 @@ struct Histo {
      * @param v value to set.
      */
     void SetCount(const unsigned long int &index, const PRECI_INTEGER &v) {
-        if (index > bins)
+        if (index >= bins)
             throw histo_error("Index is out of bounds in SetCount"
                               " Index: " +
                               std::to_string(index) +
@@ -408,6 +1331,53 @@ struct Histo {
 
     /** @} */
   protected:
+    template <typename TData>
+    bool IsInRange(const TData &value) const {
+        return value >= breaks[0] &&
+               (value < breaks[bins] ||
+                histo::isequalthan<PRECI>(value, breaks[bins]));
+    }
+    /** Regenerate equidistant breaks from low, avoiding accumulated error. */
+    void SetEquidistantBreaks(const PRECI &low, const PRECI &width) {
+        breaks.resize(bins + 1);
+        for (unsigned long int i = 0; i != bins + 1; i++) {
+            breaks[i] = low + i * width;
+        }
+        range = std::make_pair(breaks[0], breaks[bins]);
+    }
+    /** Add empty bins at both ends of equidistant breaks. */
+    void ExtendBins(const unsigned long int &n_low,
+                    const unsigned long int &n_upper) {
+        const PRECI width = breaks[1] - breaks[0];
+        const PRECI low = breaks[0] - n_low * width;
+        CountsType extended;
+        extended.assign(bins + n_low + n_upper, PRECI_INTEGER(0));
+        ForEachCount(counts, [&extended, &n_low](const unsigned long int &i,
+                                                 const PRECI_INTEGER &c) {
+            if (c != PRECI_INTEGER(0))
+                extended[i + n_low] = c;
+        });
+        counts = std::move(extended);
+        bins += n_low + n_upper;
+        SetEquidistantBreaks(low, width);
+    }
+    /** Merge pairs of adjacent equidistant bins, doubling the width. */
+    void MergeBinPairs() {
+        if (bins % 2 != 0)
+            ExtendBins(0, 1);
+        const PRECI width = 2 * (breaks[1] - breaks[0]);
+        const PRECI low = breaks[0];
+        CountsType merged;
+        merged.assign(bins / 2, PRECI_INTEGER(0));
+        ForEachCount(counts, [&merged](const unsigned long int &i,
+                                       const PRECI_INTEGER &c) {
+            if (c != PRECI_INTEGER(0))
+                merged[i / 2] += c;
+        });
+        counts = std::move(merged);
+        bins /= 2;
+        SetEquidistantBreaks(low, width);
+    }
     bool CheckIfMonotonicallyIncreasing(
             const BreaksType &input_breaks) const {
         auto prev_value = input_breaks[0];
@@ -444,16 +1414,7 @@ struct Histo {
 
     bool
     CheckBreaksAreEquidistant(const BreaksType &input_breaks) const {
-        PRECI diff = input_breaks[1] - input_breaks[0];
-        for (auto it = input_breaks.begin() + 1, it_end = input_breaks.end();
-             it != it_end; it++) {
-            // auto new_diff = *it - *(it -1);
-            // std::cout<<  new_diff <<" " << diff << std::endl;
-            // Soft comparisson, high number of epsilons.
-            if (!isequalthan<PRECI, 100>(*it - *(it - 1), diff))
-                return false;
-        }
-        return true;
+        return AreBreaksEquidistant(input_breaks);
     };
 
     bool BalanceBreaksWithRange(BreaksType &input_breaks,
@@ -553,7 +1514,11 @@ struct Histo {
     template <typename TData>
     BreaksType &ScottMethod(const std::vector<TData> &data,
                                     const RangeType &rang) {
-        PRECI sigma = variance_welford<PRECI>(data);
+        PRECI sigma;
+        {
+            HISTO_INSTRUMENT_PHASE(VariancePhase);
+            sigma = variance_welford<PRECI>(data);
+        }
         // cbrt is cubic root
         PRECI width =
                 3.5 * sqrt(sigma) / std::cbrt(static_cast<PRECI>(data.size()));
@@ -570,7 +1535,10 @@ struct Histo {
         // std::for_each(std::begin(breaks), std::end(breaks), [](const T& v)
         // {std::cout<<v <<std::endl;});
 
-        BalanceBreaksWithRange(this->breaks, this->range);
+        {
+            HISTO_INSTRUMENT_PHASE(BalanceBreaksPhase);
+            BalanceBreaksWithRange(this->breaks, this->range);
+        }
         this->bins = this->breaks.size() - 1;
         // std::cout << "Balanced new breaks" << std::endl;
         // std::cout<< "bins is: " << bins <<" width is: "<< breaks[1]-breaks[0]
@@ -582,50 +1550,235 @@ struct Histo {
     };
 };
 
-template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int>
+/**
+ * Weighted sum of bin centers by counts, divided by the number of bins.
+ * With sparse storage, only occupied bins are visited.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
 double
-Mean(const Histo<PRECI, PRECI_INTEGER> &input_histo) {
-  const auto bin_centers = input_histo.ComputeBinCenters();
+Mean(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo) {
   // std::transform_reduce, that accepts std::execution::par can be used if c++17
   // Note that std::execution::par is not widely implemented yet in all compilers
   // (in 2020, GCC needs extra linking with tbb for example).
-  const double mean = std::inner_product(std::cbegin(bin_centers), std::cend(bin_centers),
-      std::cbegin(input_histo.counts), 0.0) / input_histo.bins;
+  double sum = 0.0;
+  ForEachCount(input_histo.counts,
+      [&input_histo, &sum](const unsigned long int &i, const PRECI_INTEGER &c) {
+        sum += input_histo.ComputeBinCenter(i) * c;
+      });
+  const double mean = sum / input_histo.bins;
   return mean;
 }
 
 /**
  * Normalize the histogram by area. Useful for probability density functions.
  * The output histogram has counts with PRECI, instead of PRECI_INTEGER.
+ * With sparse storage, only occupied bins are visited, and the output
+ * keeps the same storage.
  *
  * Implemented using:
  * https://stackoverflow.com/questions/5320677/how-to-normalize-a-histogram-in-matlab
  *
  * @tparam PRECI see histo
  * @tparam PRECI_INTEGER see histo
+ * @tparam COUNTS_CONTAINER see histo
  * @param input_histo input histogram to normalize.
  *
  * @return histogram normalized with float counts.
  */
-template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int>
-Histo<PRECI, PRECI>
-NormalizeByArea(const Histo<PRECI, PRECI_INTEGER> &input_histo) {
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
+Histo<PRECI, PRECI, COUNTS_CONTAINER>
+NormalizeByArea(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo) {
     // compute the area of each bin
     double sum = 0.0;
-    for (size_t i = 0; i != input_histo.bins; ++i) {
-        sum += input_histo.counts[i] *
-               std::abs(input_histo.breaks[i + 1] - input_histo.breaks[i]);
-    }
-    Histo<PRECI, PRECI> normalized;
+    ForEachCount(input_histo.counts,
+                 [&input_histo, &sum](const unsigned long int &i,
+                                      const PRECI_INTEGER &c) {
+                     sum += c * std::abs(input_histo.breaks[i + 1] -
+                                         input_histo.breaks[i]);
+                 });
+    Histo<PRECI, PRECI, COUNTS_CONTAINER> normalized;
     normalized.bins = input_histo.bins;
     normalized.breaks = input_histo.breaks;
     // normalized_counts has different type than input_histo.counts.
-    normalized.counts.resize(input_histo.bins);
-    std::transform(std::begin(input_histo.counts), std::end(input_histo.counts),
-                   std::begin(normalized.counts),
-                   [&sum](const double &d) { return d / sum; });
+    normalized.ResetCounts();
+    ForEachCount(input_histo.counts,
+                 [&normalized, &sum](const unsigned long int &i,
+                                     const PRECI_INTEGER &c) {
+                     if (c != PRECI_INTEGER(0))
+                         normalized.counts[i] = c / sum;
+                 });
     return normalized;
 }
 
+/** \defgroup Rebin Coarsen the bins of an existing histogram. */
+/** @{
+ * @brief Merge every factor consecutive bins into one.
+ * If bins is not a multiple of factor, the last bin merges the remaining ones.
+ * Counts are preserved exactly.
+ *
+ * @param input_histo histogram to coarsen.
+ * @param factor number of bins to merge, greater than 0.
+ *
+ * @return histogram with ceil(bins / factor) bins.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
+Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>
+Rebin(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+      const unsigned long int &factor) {
+    if (factor == 0)
+        throw histo_error("Rebin: factor must be greater than 0");
+    Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> rebinned;
+    rebinned.range = input_histo.range;
+    rebinned.name = input_histo.name;
+    rebinned.bins = (input_histo.bins + factor - 1) / factor;
+    rebinned.breaks.resize(rebinned.bins + 1);
+    for (unsigned long int i = 0; i < rebinned.bins; ++i) {
+        rebinned.breaks[i] = input_histo.breaks[i * factor];
+    }
+    rebinned.breaks[rebinned.bins] = input_histo.breaks[input_histo.bins];
+    rebinned.ResetCounts();
+    ForEachCount(input_histo.counts,
+                 [&rebinned, &factor](const unsigned long int &i,
+                                      const PRECI_INTEGER &c) {
+                     if (c != PRECI_INTEGER(0))
+                         rebinned.counts[i / factor] += c;
+                 });
+    return rebinned;
+}
+
+/**
+ * @brief Redistribute counts onto new, usually coarser, breaks.
+ * Each input bin contributes to the new bins it overlaps, proportionally
+ * to the overlapping width. Counts are exact when the input bin falls
+ * entirely inside a new bin, i.e. when edges are aligned.
+ *
+ * @param input_histo histogram to rebin.
+ * @param new_breaks monotonically increasing, covering input_histo.range.
+ *
+ * @return histogram with new_breaks and PRECI counts.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
+Histo<PRECI, PRECI, COUNTS_CONTAINER>
+Rebin(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+      const std::vector<PRECI> &new_breaks) {
+    if (new_breaks.size() < 2 ||
+        !std::is_sorted(new_breaks.begin(), new_breaks.end()) ||
+        std::adjacent_find(new_breaks.begin(), new_breaks.end()) !=
+                new_breaks.end())
+        throw histo_error("Rebin: new_breaks are not monotonically increasing");
+    const auto &old_breaks = input_histo.breaks;
+    if ((new_breaks.front() > old_breaks.front() &&
+         !isequalthan<PRECI>(new_breaks.front(), old_breaks.front())) ||
+        (new_breaks.back() < old_breaks.back() &&
+         !isequalthan<PRECI>(new_breaks.back(), old_breaks.back())))
+        throw histo_error("Rebin: new_breaks do not cover the range of the "
+                          "input histogram");
+    Histo<PRECI, PRECI, COUNTS_CONTAINER> rebinned;
+    rebinned.breaks = new_breaks;
+    rebinned.range = std::make_pair(new_breaks.front(), new_breaks.back());
+    rebinned.bins = new_breaks.size() - 1;
+    rebinned.name = input_histo.name;
+    rebinned.ResetCounts();
+    ForEachCount(input_histo.counts, [&](const unsigned long int &i,
+                                         const PRECI_INTEGER &c) {
+        if (c == PRECI_INTEGER(0))
+            return;
+        const PRECI low = old_breaks[i];
+        const PRECI upper = old_breaks[i + 1];
+        // New bin containing low, clamped for the tolerance on the borders.
+        auto it = std::upper_bound(new_breaks.begin(), new_breaks.end(), low);
+        unsigned long int j = (it == new_breaks.begin())
+                                      ? 0
+                                      : static_cast<unsigned long int>(
+                                                it - new_breaks.begin() - 1);
+        j = std::min(j, rebinned.bins - 1);
+        if (upper <= new_breaks[j + 1] || j == rebinned.bins - 1) {
+            rebinned.counts[j] += c;
+            return;
+        }
+        const PRECI width = upper - low;
+        for (; j < rebinned.bins && new_breaks[j] < upper; ++j) {
+            const PRECI overlap = std::min(upper, new_breaks[j + 1]) -
+                                  std::max(low, new_breaks[j]);
+            if (overlap > 0)
+                rebinned.counts[j] += c * (overlap / width);
+        }
+    });
+    return rebinned;
+}
+/** @} */
+
+/**
+ * @brief Cached multi-resolution pyramid of a histogram.
+ * Level 0 is the input histogram, and each level halves the number of bins
+ * of the previous one with @sa Rebin(input_histo, 2).
+ * Useful for interactive zoom, pick a level with @sa LevelForMaxBins
+ * instead of filling again from data.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
+struct HistoPyramid {
+    using HistoType = Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>;
+    /** levels[k] has ceil(bins / 2^k) bins. The last level has one bin. */
+    std::vector<HistoType> levels;
+
+    HistoPyramid() = default;
+    /**
+     * @brief Build all the levels from input_histo, until a level has
+     * min_bins bins or less.
+     */
+    explicit HistoPyramid(const HistoType &input_histo,
+                          const unsigned long int &min_bins = 1) {
+        Update(input_histo, min_bins);
+    };
+
+    /** @brief Rebuild the levels from input_histo. @sa HistoPyramid */
+    void Update(const HistoType &input_histo,
+                const unsigned long int &min_bins = 1) {
+        levels.clear();
+        levels.push_back(input_histo);
+        while (levels.back().bins > std::max<unsigned long int>(min_bins, 1)) {
+            levels.push_back(Rebin(levels.back(), 2));
+        }
+    };
+
+    /** Number of levels. */
+    size_t size() const { return levels.size(); };
+
+    const HistoType &Level(const size_t &level) const {
+        if (level >= levels.size())
+            throw histo_error("HistoPyramid: level " + std::to_string(level) +
+                              " does not exist. Number of levels: " +
+                              std::to_string(levels.size()));
+        return levels[level];
+    };
+
+    /**
+     * @brief Index of the finest level with at most max_bins bins.
+     * The coarsest level is returned if no level has so few bins.
+     */
+    size_t LevelIndexForMaxBins(const unsigned long int &max_bins) const {
+        if (levels.empty())
+            throw histo_error("HistoPyramid is empty");
+        const unsigned long int m = std::max<unsigned long int>(max_bins, 1);
+        // ceil(bins / 2^k) <= m  <=>  2^k >= ceil(bins / m)
+        const unsigned long int q = (levels[0].bins + m - 1) / m;
+        size_t k = 0;
+        while ((1ul << k) < q) {
+            ++k;
+        }
+        return std::min(k, levels.size() - 1);
+    };
+
+    /** @brief @sa LevelIndexForMaxBins */
+    const HistoType &LevelForMaxBins(const unsigned long int &max_bins) const {
+        return levels[LevelIndexForMaxBins(max_bins)];
+    };
+};
+
 } // End of namespace histo
 #endif
@@ -0,0 +1,487 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_collection.hpp
+Many histograms sharing the same breaks, with all the counts stored in one
+contiguous block, one aligned and padded row per histogram.
+*/
+
+#ifndef HISTO_COLLECTION_HPP_
+#define HISTO_COLLECTION_HPP_
+#include "histo.hpp"
+#include "histo_parallel.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace histo {
+
+/**
+ * @brief Read only view of the counts of one histogram. It does not own
+ * the memory.
+ */
+template <typename T>
+class CountsView {
+  public:
+    using value_type = T;
+    using size_type = unsigned long int;
+    CountsView(const T *data, const size_type &size)
+            : data_(data), size_(size){};
+    size_type size() const { return size_; };
+    const T *data() const { return data_; };
+    const T &operator[](const size_type &index) const { return data_[index]; };
+    const T *begin() const { return data_; };
+    const T *end() const { return data_ + size_; };
+
+  private:
+    const T *data_;
+    size_type size_;
+};
+
+/** @brief @sa ForEachCount() */
+template <typename T, typename F>
+void ForEachCount(const CountsView<T> &counts, F f) {
+    for (unsigned long int i = 0; i < counts.size(); ++i) {
+        f(i, counts[i]);
+    }
+}
+
+/**
+ * @brief Read only view of one histogram of a @sa HistoCollection.
+ * Breaks and counts are not copied, the view is valid while the collection
+ * is alive and not modified.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int>
+struct HistoView {
+    using BreaksType = std::vector<PRECI>;
+    using RangeType = std::pair<PRECI, PRECI>;
+    using CountsType = CountsView<PRECI_INTEGER>;
+    /** @sa Histo::range */
+    const RangeType &range;
+    /** @sa Histo::breaks */
+    const BreaksType &breaks;
+    /** @sa Histo::bins */
+    const unsigned long int bins;
+    /** Counts of this histogram. */
+    CountsType counts;
+
+    /** @sa Histo::ComputeBinCenter */
+    PRECI ComputeBinCenter(const unsigned long int &index) const {
+        double break_width = (this->breaks[index + 1] - this->breaks[index]) / 2.0;
+        return this->breaks[index] + break_width;
+    }
+    /** @sa Histo::ComputeBinCenters */
+    BreaksType ComputeBinCenters() const {
+        BreaksType centers(this->bins);
+        for (unsigned long int i = 0; i < this->bins; i++) {
+            centers[i] = ComputeBinCenter(i);
+        }
+        return centers;
+    }
+    /** @sa Histo::IndexFromValue */
+    template <typename TData>
+    unsigned long int IndexFromValue(const TData &value) const {
+        return IndexFromBreaks(breaks, value);
+    };
+    /** @brief Copy the view into an independent Histo. */
+    Histo<PRECI, PRECI_INTEGER> ToHisto() const {
+        Histo<PRECI, PRECI_INTEGER> h;
+        h.range = range;
+        h.breaks = breaks;
+        h.bins = bins;
+        h.counts.assign(counts.begin(), counts.end());
+        return h;
+    }
+};
+
+/**
+ * @brief Collection of histograms sharing the same breaks.
+ * Structure of arrays: the breaks are stored once, and the counts of all
+ * the histograms are stored in one contiguous block, where each histogram
+ * starts at an address aligned to @sa alignment bytes. The histogram h
+ * starts at CountsOf(h), and its bins are followed by padding up to
+ * @sa stride counts.
+ *
+ * The block is allocated with Allocator, use
+ * std::pmr::polymorphic_allocator<PRECI_INTEGER> to provide an arena.
+ *
+ * @tparam PRECI see @sa Histo
+ * @tparam PRECI_INTEGER see @sa Histo
+ * @tparam Allocator allocator of the counts block.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          typename Allocator = std::allocator<PRECI_INTEGER>>
+struct HistoCollection {
+    using BreaksType = std::vector<PRECI>;
+    using RangeType = std::pair<PRECI, PRECI>;
+    using CountsType = std::vector<PRECI_INTEGER, Allocator>;
+    using AllocatorType = Allocator;
+    using ViewType = HistoView<PRECI, PRECI_INTEGER>;
+    /** Alignment in bytes of the counts of each histogram, a cache line. */
+    static constexpr unsigned long int alignment = 64;
+    /************* DATA *****************/
+    /** Low and upper limit for breaks. */
+    RangeType range;
+    /** Value of the breaks between bins, shared by all the histograms. */
+    BreaksType breaks;
+    /** breaks.size() - 1 */
+    unsigned long int bins{0};
+    /** Distance between the first count of two consecutive histograms,
+     * bins plus padding. */
+    unsigned long int stride{0};
+    /** Number of histograms in the collection. */
+    unsigned long int number_of_histograms{0};
+    /** Block with the counts of all the histograms, access them with
+     * CountsOf(h). */
+    CountsType counts;
+    /** name/description of the collection */
+    std::string name;
+
+    /********** CONSTRUCTORS ************/
+    explicit HistoCollection(const Allocator &alloc = Allocator())
+            : counts(alloc){};
+
+    /**
+     * @brief Constructor with empty counts.
+     *
+     * @param input_breaks breaks shared by all the histograms.
+     * @param input_number_of_histograms
+     * @param alloc allocator for the counts block.
+     */
+    HistoCollection(const BreaksType &input_breaks,
+                    const unsigned long int &input_number_of_histograms,
+                    const Allocator &alloc = Allocator())
+            : breaks(input_breaks),
+              number_of_histograms(input_number_of_histograms),
+              counts(alloc) {
+        if (breaks.size() < 2)
+            throw histo_error("HistoCollection: at least two breaks are "
+                              "needed");
+        range = std::make_pair(breaks.front(), breaks.back());
+        bins = static_cast<decltype(bins)>(breaks.size() - 1);
+        ResetCounts();
+    };
+
+    /**
+     * @brief Grouped constructor, fill one histogram per label in a single
+     * pass over data. @sa FillGroupedCounts
+     *
+     * @param data values
+     * @param labels parallel to data, in [0, input_number_of_histograms)
+     * @param input_breaks breaks shared by all the histograms.
+     * @param input_number_of_histograms
+     * @param num_threads threads to use, 0 for hardware_concurrency.
+     * @param alloc allocator for the counts block.
+     */
+    template <typename TData, typename TLabel>
+    HistoCollection(const std::vector<TData> &data,
+                    const std::vector<TLabel> &labels,
+                    const BreaksType &input_breaks,
+                    const unsigned long int &input_number_of_histograms,
+                    const unsigned int &num_threads = 0,
+                    const Allocator &alloc = Allocator())
+            : HistoCollection(input_breaks, input_number_of_histograms, alloc) {
+        FillGroupedCounts(data, labels, num_threads);
+    };
+
+    HistoCollection(const HistoCollection &other)
+            : range(other.range), breaks(other.breaks), bins(other.bins),
+              number_of_histograms(other.number_of_histograms),
+              counts(std::allocator_traits<Allocator>::
+                             select_on_container_copy_construction(
+                                     other.counts.get_allocator())),
+              name(other.name) {
+        ResetCounts();
+        std::copy(other.CountsOf(0), other.CountsOf(number_of_histograms),
+                  CountsOf(0));
+    };
+    HistoCollection &operator=(const HistoCollection &other) {
+        if (this != &other) {
+            CopyMetadata(other);
+            ResetCounts();
+            std::copy(other.CountsOf(0), other.CountsOf(number_of_histograms),
+                      CountsOf(0));
+        }
+        return *this;
+    };
+    // Moving the vector steals its buffer, and so keeps the alignment.
+    HistoCollection(HistoCollection &&) = default;
+    HistoCollection &operator=(HistoCollection &&other) {
+        if (this != &other) {
+            const PRECI_INTEGER *other_first = other.CountsOf(0);
+            CopyMetadata(other);
+            offset_ = other.offset_;
+            counts = std::move(other.counts);
+            if (CountsOf(0) != other_first) {
+                // Allocators are not equal and do not propagate:
+                // elements were moved one by one to a new buffer.
+                const CountsType moved(counts);
+                const unsigned long int moved_offset = offset_;
+                ResetCounts();
+                std::copy(moved.data() + moved_offset,
+                          moved.data() + moved_offset +
+                                  number_of_histograms * stride,
+                          CountsOf(0));
+            }
+        }
+        return *this;
+    };
+
+    /********* PUBLIC METHODS ***********/
+    /** @brief Allocate the counts block and reset values to zero. */
+    void ResetCounts() {
+        const unsigned long int per_line =
+                (alignment % sizeof(PRECI_INTEGER) == 0)
+                        ? alignment / sizeof(PRECI_INTEGER)
+                        : 1;
+        stride = (bins + per_line - 1) / per_line * per_line;
+        counts.assign(number_of_histograms * stride + per_line - 1,
+                      PRECI_INTEGER(0));
+        const auto address = reinterpret_cast<std::uintptr_t>(counts.data());
+        offset_ = (per_line == 1 || address % sizeof(PRECI_INTEGER) != 0)
+                          ? 0
+                          : ((alignment - address % alignment) % alignment) /
+                                    sizeof(PRECI_INTEGER);
+    };
+
+    /** @brief Pointer to the first count of the histogram with index h. */
+    PRECI_INTEGER *CountsOf(const unsigned long int &h) {
+        return counts.data() + offset_ + h * stride;
+    };
+    /** @brief @sa CountsOf */
+    const PRECI_INTEGER *CountsOf(const unsigned long int &h) const {
+        return counts.data() + offset_ + h * stride;
+    };
+
+    /** @brief View of the histogram with index h, without copies. */
+    ViewType View(const unsigned long int &h) const {
+        CheckIndex(h, "View");
+        return ViewType{range, breaks, bins, CountsView<PRECI_INTEGER>(CountsOf(h), bins)};
+    };
+
+    /**
+     * @brief Copy the counts of input_histo into the histogram h.
+     * input_histo must have the same breaks than the collection.
+     */
+    template <template <typename...> class COUNTS_CONTAINER>
+    void SetHistogram(
+            const unsigned long int &h,
+            const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo) {
+        CheckIndex(h, "SetHistogram");
+        if (input_histo.breaks != breaks)
+            throw histo_error("SetHistogram: input histogram has different "
+                              "breaks than the collection");
+        PRECI_INTEGER *row = CountsOf(h);
+        std::fill(row, row + bins, PRECI_INTEGER(0));
+        ForEachCount(input_histo.counts,
+                     [&row](const unsigned long int &i, const PRECI_INTEGER &c) {
+                         row[i] = c;
+                     });
+    };
+
+    /**
+     * @brief Fill the counts of all the histograms in a single pass over
+     * data. The histogram of data[i] is labels[i].
+     *
+     * Each thread fills a private [histogram][bin] matrix from a chunk of
+     * data, and the partial matrices are then added in parallel.
+     * Memory of the partials is num_threads * number_of_histograms * bins.
+     *
+     * @param data values
+     * @param labels parallel to data, in [0, number_of_histograms)
+     * @param num_threads threads to use, 0 for hardware_concurrency.
+     *
+     * Read the result per histogram with @sa CountsOf or @sa View, the
+     * counts block is padded and aligned.
+     *
+     * Throws if a label or a value is out of range, leaving the counts
+     * unchanged.
+     */
+    template <typename TData, typename TLabel>
+    void FillGroupedCounts(const std::vector<TData> &data,
+                           const std::vector<TLabel> &labels,
+                           const unsigned int &num_threads = 0) {
+        static_assert(std::is_integral<TLabel>::value,
+                      "FillGroupedCounts requires integral labels.");
+        if (data.size() != labels.size())
+            throw histo_error("FillGroupedCounts: data and labels have "
+                              "different sizes");
+        HISTO_INSTRUMENT_PHASE(GroupedFillPhase);
+        HISTO_INSTRUMENT(RecordSamples(SearchIndexPath, data.size()));
+        const unsigned int nthreads = NumberOfThreads(num_threads, data.size());
+        if (nthreads == 1) {
+            FillGroupedChunk(data, labels, 0, data.size(), CountsOf(0));
+            return;
+        }
+        const size_t total = number_of_histograms * stride;
+        std::vector<std::vector<PRECI_INTEGER>> partials(nthreads);
+        ParallelForChunks(data.size(), nthreads,
+                          [&](const unsigned int &t, const size_t &begin,
+                              const size_t &end) {
+                              // Allocated by its own thread: first touch.
+                              partials[t].assign(total, PRECI_INTEGER(0));
+                              FillGroupedChunk(data, labels, begin, end,
+                                               partials[t].data());
+                          });
+        PRECI_INTEGER *output = CountsOf(0);
+        ParallelForChunks(total, nthreads,
+                          [&](const unsigned int &, const size_t &begin,
+                              const size_t &end) {
+                              for (const auto &partial : partials) {
+                                  for (size_t i = begin; i < end; ++i) {
+                                      output[i] += partial[i];
+                                  }
+                              }
+                          });
+    };
+
+    /** \defgroup BatchOperations Batch operations over all the histograms */
+    /** @{
+     * @brief @sa Mean of every histogram.
+     * The bin centers are computed once, and each row is a contiguous
+     * inner product.
+     *
+     * @return vector with number_of_histograms means.
+     */
+    std::vector<double> MeanAll() const {
+        std::vector<double> centers(bins);
+        for (unsigned long int b = 0; b < bins; ++b) {
+            centers[b] = (breaks[b] + breaks[b + 1]) / 2.0;
+        }
+        std::vector<double> means(number_of_histograms);
+        for (unsigned long int h = 0; h < number_of_histograms; ++h) {
+            const PRECI_INTEGER *row = CountsOf(h);
+            double sum = 0.0;
+            for (unsigned long int b = 0; b < bins; ++b) {
+                sum += centers[b] * row[b];
+            }
+            means[h] = sum / bins;
+        }
+        return means;
+    };
+
+    /**
+     * @brief @sa NormalizeByArea of every histogram.
+     * The widths of the bins are computed once for all the histograms.
+     *
+     * @return collection with the same breaks and normalized PRECI counts.
+     */
+    HistoCollection<PRECI, PRECI,
+                    typename std::allocator_traits<
+                            Allocator>::template rebind_alloc<PRECI>>
+    NormalizeAllByArea() const {
+        using OutAllocator = typename std::allocator_traits<
+                Allocator>::template rebind_alloc<PRECI>;
+        HistoCollection<PRECI, PRECI, OutAllocator> normalized(
+                breaks, number_of_histograms,
+                OutAllocator(counts.get_allocator()));
+        normalized.name = name;
+        std::vector<double> widths(bins);
+        for (unsigned long int b = 0; b < bins; ++b) {
+            widths[b] = std::abs(breaks[b + 1] - breaks[b]);
+        }
+        for (unsigned long int h = 0; h < number_of_histograms; ++h) {
+            const PRECI_INTEGER *row = CountsOf(h);
+            double sum = 0.0;
+            for (unsigned long int b = 0; b < bins; ++b) {
+                sum += row[b] * widths[b];
+            }
+            PRECI *out = normalized.CountsOf(h);
+            for (unsigned long int b = 0; b < bins; ++b) {
+                out[b] = row[b] / sum;
+            }
+        }
+        return normalized;
+    };
+
+    /**
+     * @brief Merge all the histograms of the collection adding their counts.
+     *
+     * @return Histo with the shared breaks and the total counts.
+     */
+    Histo<PRECI, PRECI_INTEGER> MergeAll() const {
+        Histo<PRECI, PRECI_INTEGER> merged;
+        merged.range = range;
+        merged.breaks = breaks;
+        merged.bins = bins;
+        merged.name = name;
+        merged.ResetCounts();
+        PRECI_INTEGER *out = merged.counts.data();
+        for (unsigned long int h = 0; h < number_of_histograms; ++h) {
+            const PRECI_INTEGER *row = CountsOf(h);
+            for (unsigned long int b = 0; b < bins; ++b) {
+                out[b] += row[b];
+            }
+        }
+        return merged;
+    };
+    /** @} */
+
+  protected:
+    template <typename TOther>
+    void CopyMetadata(const TOther &other) {
+        range = other.range;
+        breaks = other.breaks;
+        bins = other.bins;
+        stride = other.stride;
+        number_of_histograms = other.number_of_histograms;
+        name = other.name;
+    };
+    void CheckIndex(const unsigned long int &h, const std::string &where) const {
+        if (h >= number_of_histograms)
+            throw histo_error(where + ": index " + std::to_string(h) +
+                              " is out of bounds. Number of histograms: " +
+                              std::to_string(number_of_histograms));
+    };
+
+    template <typename TData, typename TLabel>
+    void FillGroupedChunk(const std::vector<TData> &data,
+                          const std::vector<TLabel> &labels,
+                          const size_t &begin,
+                          const size_t &end,
+                          PRECI_INTEGER *output) const {
+        auto slot = [&](const size_t &i) {
+            const auto label = labels[i];
+            if (IsNegativeLabel(label, std::is_signed<TLabel>()) ||
+                static_cast<unsigned long long>(label) >= number_of_histograms)
+                throw histo_error("FillGroupedCounts: label " +
+                                  std::to_string(label) +
+                                  " is out of bounds. Number of histograms: " +
+                                  std::to_string(number_of_histograms));
+            return static_cast<unsigned long int>(label) * stride +
+                   IndexFromBreaks(breaks, data[i]);
+        };
+        size_t i = begin;
+        try {
+            for (; i < end; ++i)
+                output[slot(i)]++;
+        } catch (...) {
+            // Undo the samples already filled, output is left unchanged.
+            for (size_t j = begin; j < i; ++j)
+                output[slot(j)]--;
+            throw;
+        }
+    };
+
+    template <typename TLabel>
+    static bool IsNegativeLabel(const TLabel &label, std::true_type) {
+        return label < 0;
+    };
+    template <typename TLabel>
+    static bool IsNegativeLabel(const TLabel &, std::false_type) {
+        return false;
+    };
+
+    /** Counts before CountsOf(0), to align it. */
+    unsigned long int offset_{0};
+};
+template <typename PRECI, typename PRECI_INTEGER, typename Allocator>
+constexpr unsigned long int
+        HistoCollection<PRECI, PRECI_INTEGER, Allocator>::alignment;
+
+} // End of namespace histo
+#endif
@@ -0,0 +1,247 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_distances.hpp
+Distances between histograms with the same breaks, and batch queries of one
+histogram against a @sa HistoCollection.
+*/
+
+#ifndef HISTO_DISTANCES_HPP_
+#define HISTO_DISTANCES_HPP_
+#include "histo.hpp"
+#include "histo_collection.hpp"
+#include "histo_parallel.hpp"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Kernels are vectorized with OpenMP simd pragmas when compiled with
+// -fopenmp or -fopenmp-simd (CMake option WITH_OPENMP_SIMD).
+#if defined(_OPENMP) || defined(HISTO_OPENMP_SIMD)
+#define HISTO_PRAGMA(x) _Pragma(#x)
+#define HISTO_SIMD_REDUCTION(var) HISTO_PRAGMA(omp simd reduction(+ : var))
+#else
+#define HISTO_SIMD_REDUCTION(var)
+#endif
+
+namespace histo {
+/** \defgroup distance_methods distance_methods */
+/**@{
+ * @brief Distances between histograms, computed on the probability mass of
+ * each bin (counts divided by the total counts).
+ */
+enum distance_method {
+    /** 0.5 * sum (p - q)^2 / (p + q). In [0, 1]. */
+    ChiSquareDistance = 0,
+    /** 1 - sum min(p, q). In [0, 1]. */
+    IntersectionDistance,
+    /** -ln(sum sqrt(p * q)). Infinite for disjoint histograms. */
+    BhattacharyyaDistance,
+    /** sum p * ln(p / q). Not symmetric, infinite if q = 0 where p > 0. */
+    KullbackLeiblerDivergence,
+    /** 0.5 * KL(p, m) + 0.5 * KL(q, m), with m = (p + q) / 2. In [0, ln 2]. */
+    JensenShannonDivergence,
+    /** 1D Earth Mover's distance: sum |P - Q| * (center[i+1] - center[i]),
+     * where P, Q are the cumulative distributions. */
+    EarthMoversDistance
+};
+/** @} */
+
+/**
+ * @brief Distance between two probability mass arrays of size n.
+ * p[i] * p_scale and q[i] * q_scale are the masses, so raw counts can be
+ * used with scale 1 / total_counts without normalizing them first.
+ *
+ * @param gaps distance between consecutive bin centers, size n - 1,
+ * only used by EarthMoversDistance.
+ */
+template <typename TP, typename TQ>
+double DistanceKernel(const TP *p, const double &p_scale,
+                      const TQ *q, const double &q_scale,
+                      const size_t &n, const double *gaps,
+                      const distance_method &method) {
+    double sum = 0.0;
+    switch (method) {
+    case ChiSquareDistance:
+        HISTO_SIMD_REDUCTION(sum)
+        for (size_t i = 0; i < n; ++i) {
+            const double a = p[i] * p_scale;
+            const double b = q[i] * q_scale;
+            const double s = a + b;
+            const double d = a - b;
+            sum += s > 0.0 ? d * d / s : 0.0;
+        }
+        return 0.5 * sum;
+    case IntersectionDistance:
+        HISTO_SIMD_REDUCTION(sum)
+        for (size_t i = 0; i < n; ++i) {
+            const double a = p[i] * p_scale;
+            const double b = q[i] * q_scale;
+            sum += a < b ? a : b;
+        }
+        return 1.0 - sum;
+    case BhattacharyyaDistance:
+        HISTO_SIMD_REDUCTION(sum)
+        for (size_t i = 0; i < n; ++i) {
+            sum += std::sqrt((p[i] * p_scale) * (q[i] * q_scale));
+        }
+        return sum > 0.0 ? -std::log(std::min(sum, 1.0))
+                         : std::numeric_limits<double>::infinity();
+    case KullbackLeiblerDivergence:
+        for (size_t i = 0; i < n; ++i) {
+            const double a = p[i] * p_scale;
+            const double b = q[i] * q_scale;
+            if (a > 0.0) {
+                if (!(b > 0.0))
+                    return std::numeric_limits<double>::infinity();
+                sum += a * std::log(a / b);
+            }
+        }
+        return sum;
+    case JensenShannonDivergence:
+        for (size_t i = 0; i < n; ++i) {
+            const double a = p[i] * p_scale;
+            const double b = q[i] * q_scale;
+            const double m = 0.5 * (a + b);
+            if (a > 0.0)
+                sum += a * std::log(a / m);
+            if (b > 0.0)
+                sum += b * std::log(b / m);
+        }
+        return 0.5 * sum;
+    case EarthMoversDistance: {
+        // The running difference of the cumulative distributions is a
+        // dependency chain, the sum itself is a plain reduction.
+        double cdf_diff = 0.0;
+        for (size_t i = 0; i + 1 < n; ++i) {
+            cdf_diff += p[i] * p_scale - q[i] * q_scale;
+            sum += std::abs(cdf_diff) * gaps[i];
+        }
+        return sum;
+    }
+    default:
+        throw histo_error("DistanceKernel: No Valid Method selected.");
+    }
+}
+
+/**
+ * @brief Distance between consecutive bin centers of breaks.
+ * @sa EarthMoversDistance
+ */
+template <typename PRECI>
+std::vector<double> CenterGapsFromBreaks(const std::vector<PRECI> &breaks) {
+    std::vector<double> gaps(breaks.size() > 2 ? breaks.size() - 2 : 0);
+    for (size_t i = 0; i < gaps.size(); ++i) {
+        gaps[i] = (breaks[i + 2] - breaks[i]) / 2.0;
+    }
+    return gaps;
+}
+
+/**
+ * @brief Probability mass of each bin of a histogram,
+ * counts divided by the total counts.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
+std::vector<double>
+ProbabilityMass(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo) {
+    std::vector<double> mass(input_histo.bins, 0.0);
+    double total = 0.0;
+    ForEachCount(input_histo.counts,
+                 [&mass, &total](const unsigned long int &i,
+                                 const PRECI_INTEGER &c) {
+                     mass[i] = static_cast<double>(c);
+                     total += mass[i];
+                 });
+    if (total > 0.0) {
+        for (auto &m : mass) {
+            m /= total;
+        }
+    }
+    return mass;
+}
+
+/**
+ * @brief Distance between two histograms with the same breaks.
+ *
+ * @param a first histogram.
+ * @param b second histogram, breaks must be equal to a.breaks.
+ * @param method @sa histo::distance_method
+ *
+ * @return distance computed on the probability mass of the bins.
+ */
+template <typename PRECI, typename PRECI_INTEGER_A,
+          template <typename...> class COUNTS_CONTAINER_A,
+          typename PRECI_INTEGER_B,
+          template <typename...> class COUNTS_CONTAINER_B>
+double Distance(const Histo<PRECI, PRECI_INTEGER_A, COUNTS_CONTAINER_A> &a,
+                const Histo<PRECI, PRECI_INTEGER_B, COUNTS_CONTAINER_B> &b,
+                const distance_method &method) {
+    if (a.breaks != b.breaks)
+        throw histo_error("Distance: histograms have different breaks");
+    const auto p = ProbabilityMass(a);
+    const auto q = ProbabilityMass(b);
+    const auto gaps = CenterGapsFromBreaks(a.breaks);
+    return DistanceKernel(p.data(), 1.0, q.data(), 1.0, p.size(), gaps.data(),
+                          method);
+}
+
+/**
+ * @brief Distances of one query histogram to all the histograms of a
+ * collection with the same breaks, in parallel.
+ * The query is normalized once. The counts of the collection are not
+ * normalized into a copy: each stored histogram is read twice, once for its
+ * total and once, scaled on the fly, by the kernel. The second read hits
+ * the cache unless a row is larger than it.
+ *
+ * @param query histogram to compare, breaks must be equal to
+ * collection.breaks.
+ * @param collection stored histograms.
+ * @param method @sa histo::distance_method
+ * @param num_threads threads to use, 0 for hardware_concurrency.
+ *
+ * @return distances[h] = Distance(query, collection.View(h))
+ */
+template <typename PRECI, typename PRECI_INTEGER_Q,
+          template <typename...> class COUNTS_CONTAINER_Q,
+          typename PRECI_INTEGER, typename Allocator>
+std::vector<double>
+Distances(const Histo<PRECI, PRECI_INTEGER_Q, COUNTS_CONTAINER_Q> &query,
+          const HistoCollection<PRECI, PRECI_INTEGER, Allocator> &collection,
+          const distance_method &method,
+          const unsigned int &num_threads = 0) {
+    if (query.breaks != collection.breaks)
+        throw histo_error("Distances: query and collection have different "
+                          "breaks");
+    const auto p = ProbabilityMass(query);
+    const auto gaps = CenterGapsFromBreaks(query.breaks);
+    const unsigned long int bins = collection.bins;
+    std::vector<double> distances(collection.number_of_histograms);
+    const unsigned int nthreads =
+            NumberOfThreads(num_threads, collection.number_of_histograms);
+    ParallelForChunks(
+            collection.number_of_histograms, nthreads,
+            [&](const unsigned int &, const size_t &begin, const size_t &end) {
+                for (size_t h = begin; h < end; ++h) {
+                    const PRECI_INTEGER *row = collection.CountsOf(h);
+                    double total = 0.0;
+                    HISTO_SIMD_REDUCTION(total)
+                    for (unsigned long int i = 0; i < bins; ++i) {
+                        total += static_cast<double>(row[i]);
+                    }
+                    const double scale = total > 0.0 ? 1.0 / total : 0.0;
+                    distances[h] = DistanceKernel(p.data(), 1.0, row, scale,
+                                                  bins, gaps.data(), method);
+                }
+            });
+    return distances;
+}
+
+} // End of namespace histo
+
+#undef HISTO_SIMD_REDUCTION
+#undef HISTO_PRAGMA
+#endif
@@ -0,0 +1,296 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_equalize.hpp
+Transfer functions from histograms: equalization and histogram matching,
+stored as lookup tables, and a parallel kernel to apply them to data.
+*/
+
+#ifndef HISTO_EQUALIZE_HPP_
+#define HISTO_EQUALIZE_HPP_
+#include "histo.hpp"
+#include "histo_parallel.hpp"
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace histo {
+
+/**
+ * @brief Transfer function defined per bin: values in the bin i of breaks
+ * are mapped to table[i]. Values out of range are clamped to the first or
+ * last bin.
+ *
+ * The bin of a value is computed arithmetically if the breaks are
+ * equidistant, and with a binary search otherwise.
+ *
+ * @tparam PRECI precision of the breaks, see @sa Histo
+ * @tparam TOut type of the output values.
+ */
+template <typename PRECI = double, typename TOut = PRECI>
+struct LookupTable {
+    using BreaksType = std::vector<PRECI>;
+    using TableType = std::vector<TOut>;
+    /************* DATA *****************/
+    /** Breaks of the input values. */
+    BreaksType breaks;
+    /** breaks.size() - 1 */
+    unsigned long int bins{0};
+    /** Output value for each bin. */
+    TableType table;
+    /** True if index is computed arithmetically. */
+    bool equidistant{false};
+    /** breaks[0] */
+    PRECI low{0};
+    /** 1 / width, when equidistant. */
+    PRECI inv_width{0};
+
+    /********** CONSTRUCTORS ************/
+    LookupTable() = default;
+    LookupTable(const BreaksType &input_breaks, const TableType &input_table)
+            : breaks(input_breaks), table(input_table) {
+        if (breaks.size() < 2 || table.size() != breaks.size() - 1)
+            throw histo_error("LookupTable: table must have one value per bin "
+                              "of breaks");
+        bins = static_cast<decltype(bins)>(breaks.size() - 1);
+        equidistant = AreBreaksEquidistant(breaks);
+        low = breaks[0];
+        inv_width = static_cast<PRECI>(bins) / (breaks[bins] - breaks[0]);
+    };
+
+    /********* PUBLIC METHODS ***********/
+    /**
+     * @brief Bin of value, clamped to [0, bins - 1].
+     * Same bin as @sa IndexFromBreaks for values in range: the last bin i
+     * with breaks[i] <= value. @sa IndexFromEquidistantBreaks
+     */
+    template <typename TData>
+    unsigned long int Index(const TData &value) const {
+        if (equidistant) {
+            if (!(value > low))
+                return 0;
+            if (!(value < breaks[bins]))
+                return bins - 1;
+            return IndexFromEquidistantBreaks(breaks, inv_width, value);
+        }
+        const auto it = std::upper_bound(breaks.begin() + 1, breaks.end() - 1,
+                                         value);
+        return static_cast<unsigned long int>(it - breaks.begin() - 1);
+    };
+
+    /** @brief Output value of input value. */
+    template <typename TData>
+    TOut operator()(const TData &value) const {
+        return table[Index(value)];
+    };
+};
+
+/**
+ * @brief Histogram equalization: map each bin to the output range
+ * proportionally to the cumulative counts up to that bin.
+ *
+ * output[i] = out_low + (out_upper - out_low) *
+ *             (cdf[i] - cdf_min) / (total - cdf_min)
+ *
+ * where cdf[i] is the sum of counts of bins [0, i], and cdf_min the first
+ * non-zero cdf.
+ *
+ * @param input_histo histogram of the values to equalize.
+ * @param out_low output value of the lowest bin.
+ * @param out_upper output value of the highest bin.
+ *
+ * @return lookup table with the breaks of input_histo.
+ */
+template <typename TOut = double, typename PRECI = double,
+          typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector>
+LookupTable<PRECI, TOut>
+EqualizationLUT(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+                const TOut &out_low, const TOut &out_upper) {
+    std::vector<double> cdf(input_histo.bins, 0.0);
+    ForEachCount(input_histo.counts,
+                 [&cdf](const unsigned long int &i, const PRECI_INTEGER &c) {
+                     cdf[i] = static_cast<double>(c);
+                 });
+    std::partial_sum(cdf.begin(), cdf.end(), cdf.begin());
+    const double total = cdf.empty() ? 0.0 : cdf.back();
+    const auto first_non_zero = std::find_if(
+            cdf.begin(), cdf.end(), [](const double &c) { return c > 0.0; });
+    const double cdf_min = first_non_zero == cdf.end() ? 0.0 : *first_non_zero;
+    const double out_width = static_cast<double>(out_upper) - out_low;
+    std::vector<TOut> table(input_histo.bins);
+    for (unsigned long int i = 0; i < input_histo.bins; ++i) {
+        const double ratio = total > cdf_min
+                                     ? std::max(cdf[i] - cdf_min, 0.0) /
+                                               (total - cdf_min)
+                                     : 0.0;
+        table[i] = static_cast<TOut>(out_low + out_width * ratio);
+    }
+    return LookupTable<PRECI, TOut>(input_histo.breaks, table);
+}
+
+/**
+ * @brief Histogram matching (specification): map each bin of source to the
+ * value of reference with the same cumulative distribution.
+ * The inverse cumulative distribution of reference is interpolated linearly
+ * inside its bins.
+ *
+ * @param source histogram of the values to transform.
+ * @param reference histogram with the desired distribution.
+ *
+ * @return lookup table with the breaks of source, and values in the range
+ * of reference.
+ */
+template <typename PRECI = double, typename PRECI_INTEGER = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER = std::vector,
+          typename PRECI_INTEGER_REF = unsigned long int,
+          template <typename...> class COUNTS_CONTAINER_REF = std::vector>
+LookupTable<PRECI, PRECI>
+MatchingLUT(const Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &source,
+            const Histo<PRECI, PRECI_INTEGER_REF, COUNTS_CONTAINER_REF> &reference) {
+    std::vector<double> cdf_source(source.bins, 0.0);
+    ForEachCount(source.counts,
+                 [&cdf_source](const unsigned long int &i, const PRECI_INTEGER &c) {
+                     cdf_source[i] = static_cast<double>(c);
+                 });
+    std::partial_sum(cdf_source.begin(), cdf_source.end(), cdf_source.begin());
+    std::vector<double> cdf_reference(reference.bins, 0.0);
+    ForEachCount(reference.counts,
+                 [&cdf_reference](const unsigned long int &i,
+                                  const PRECI_INTEGER_REF &c) {
+                     cdf_reference[i] = static_cast<double>(c);
+                 });
+    std::partial_sum(cdf_reference.begin(), cdf_reference.end(),
+                     cdf_reference.begin());
+    const double total_source = cdf_source.empty() ? 0.0 : cdf_source.back();
+    const double total_reference =
+            cdf_reference.empty() ? 0.0 : cdf_reference.back();
+    if (total_reference <= 0.0)
+        throw histo_error("MatchingLUT: reference histogram is empty");
+
+    std::vector<PRECI> table(source.bins);
+    for (unsigned long int i = 0; i < source.bins; ++i) {
+        const double target = total_source > 0.0
+                                      ? cdf_source[i] / total_source *
+                                                total_reference
+                                      : 0.0;
+        // First reference bin reaching the target cumulative count.
+        auto it = std::lower_bound(cdf_reference.begin(), cdf_reference.end(),
+                                   target);
+        if (it == cdf_reference.end())
+            --it;
+        const unsigned long int j =
+                static_cast<unsigned long int>(it - cdf_reference.begin());
+        const double previous = j == 0 ? 0.0 : cdf_reference[j - 1];
+        const double mass = cdf_reference[j] - previous;
+        const double fraction =
+                mass > 0.0 ? std::min(std::max((target - previous) / mass, 0.0), 1.0)
+                           : 1.0;
+        table[i] = static_cast<PRECI>(
+                reference.breaks[j] +
+                fraction * (reference.breaks[j + 1] - reference.breaks[j]));
+    }
+    return LookupTable<PRECI, PRECI>(source.breaks, table);
+}
+
+/**
+ * @brief Convert an output of a lookup table to the data type, rounding
+ * and clamping when the data is integral and the output is not.
+ */
+template <typename TData, typename TOut>
+TData ConvertLookupOutput(const TOut &value) {
+    if (std::is_integral<TData>::value && !std::is_integral<TOut>::value) {
+        const double rounded = std::nearbyint(static_cast<double>(value));
+        if (rounded <= static_cast<double>(std::numeric_limits<TData>::lowest()))
+            return std::numeric_limits<TData>::lowest();
+        if (rounded >= static_cast<double>(std::numeric_limits<TData>::max()))
+            return std::numeric_limits<TData>::max();
+        return static_cast<TData>(rounded);
+    }
+    return static_cast<TData>(value);
+}
+
+/**
+ * @brief Apply a lookup table in place to n values of data, in parallel.
+ *
+ * For integral data whose range in breaks has at most max_direct_table
+ * integer values (i.e. 8 or 16 bits images), a table indexed directly by
+ * value is built first, so each value costs a single load.
+ * Otherwise, each value is converted with @sa LookupTable::operator().
+ *
+ * @param lut lookup table.
+ * @param data values to transform in place.
+ * @param n number of values.
+ * @param num_threads threads to use, 0 for hardware_concurrency.
+ * @param max_direct_table maximum size of the direct table.
+ */
+template <typename TData, typename PRECI, typename TOut>
+void ApplyLUT(const LookupTable<PRECI, TOut> &lut,
+              TData *data,
+              const size_t &n,
+              const unsigned int &num_threads = 0,
+              const size_t &max_direct_table = 1 << 20) {
+    HISTO_INSTRUMENT_PHASE(ApplyLUTPhase);
+    const unsigned int nthreads = NumberOfThreads(num_threads, n);
+    if (std::is_integral<TData>::value) {
+        const double first = std::max<double>(
+                std::ceil(static_cast<double>(lut.breaks.front())),
+                static_cast<double>(std::numeric_limits<TData>::lowest()));
+        const double last = std::min<double>(
+                std::floor(static_cast<double>(lut.breaks.back())),
+                static_cast<double>(std::numeric_limits<TData>::max()));
+        if (last >= first && last - first + 1 <= max_direct_table) {
+            const TData direct_low = static_cast<TData>(first);
+            const TData direct_upper = static_cast<TData>(last);
+            std::vector<TData> direct(static_cast<size_t>(last - first) + 1);
+            for (size_t k = 0; k < direct.size(); ++k) {
+                direct[k] = ConvertLookupOutput<TData>(
+                        lut(static_cast<TData>(direct_low + k)));
+            }
+            HISTO_INSTRUMENT(RecordSamples(LUTIndexPath, n));
+            // Out of range values clamp to the first or last bin, that may
+            // hold no integer value.
+            const TData below = ConvertLookupOutput<TData>(lut.table.front());
+            const TData above = ConvertLookupOutput<TData>(lut.table.back());
+            ParallelForChunks(n, nthreads, [&](const unsigned int &,
+                                               const size_t &begin,
+                                               const size_t &end) {
+                const TData *table = direct.data();
+                for (size_t i = begin; i < end; ++i) {
+                    const TData v = data[i];
+                    data[i] = v < direct_low
+                                      ? below
+                                      : v > direct_upper
+                                                ? above
+                                                : table[static_cast<size_t>(
+                                                          v - direct_low)];
+                }
+            });
+            return;
+        }
+    }
+    HISTO_INSTRUMENT(RecordSamples(
+            lut.equidistant ? UniformIndexPath : SearchIndexPath, n));
+    ParallelForChunks(n, nthreads, [&](const unsigned int &,
+                                       const size_t &begin,
+                                       const size_t &end) {
+        for (size_t i = begin; i < end; ++i) {
+            data[i] = ConvertLookupOutput<TData>(lut(data[i]));
+        }
+    });
+}
+
+/** @brief @sa ApplyLUT */
+template <typename TData, typename PRECI, typename TOut>
+void ApplyLUT(const LookupTable<PRECI, TOut> &lut,
+              std::vector<TData> &data,
+              const unsigned int &num_threads = 0) {
+    ApplyLUT(lut, data.data(), data.size(), num_threads);
+}
+
+} // End of namespace histo
+#endif
@@ -0,0 +1,266 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_instrumentation.hpp
+Opt-in instrumentation of the fills: time per phase, samples processed,
+values out of range, index path and thread utilization.
+
+It is compiled out entirely unless HISTO_ENABLE_INSTRUMENTATION is defined
+(CMake option WITH_INSTRUMENTATION). The statistics are accumulated in a
+process-wide registry, read them with @sa histo::GetFillStats.
+
+The macro changes the bodies of inline functions and templates of every
+histo header, so it must have the same value in all the translation units
+linked into a program, otherwise the One Definition Rule is violated and
+the linker silently keeps either version. Define it for the whole build
+(the CMake option sets it on the histo INTERFACE target), not per file or
+with a \#define before an include.
+*/
+
+#ifndef HISTO_INSTRUMENTATION_HPP_
+#define HISTO_INSTRUMENTATION_HPP_
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#ifdef HISTO_ENABLE_INSTRUMENTATION
+/** Execute statement only when instrumentation is enabled. */
+#define HISTO_INSTRUMENT(statement) statement
+#define HISTO_INSTRUMENT_CONCAT_(a, b) a##b
+#define HISTO_INSTRUMENT_CONCAT(a, b) HISTO_INSTRUMENT_CONCAT_(a, b)
+/** Time the rest of the scope as phase. @sa histo::fill_phase */
+#define HISTO_INSTRUMENT_PHASE(phase)                                         \
+    histo::ScopedPhaseTimer HISTO_INSTRUMENT_CONCAT(histo_phase_timer_,        \
+                                                    __LINE__)(phase)
+#else
+#define HISTO_INSTRUMENT(statement)
+#define HISTO_INSTRUMENT_PHASE(phase)
+#endif
+
+namespace histo {
+/** \defgroup fill_phases fill_phases */
+/**@{
+ * @brief Phases timed by the instrumentation.
+ */
+enum fill_phase {
+    /** std::minmax_element of the data, to get the range. */
+    MinMaxPhase = 0,
+    /** variance_welford of the data, Scott method. */
+    VariancePhase,
+    /** Histo::BalanceBreaksWithRange */
+    BalanceBreaksPhase,
+    /** Histo::FillCounts */
+    FillCountsPhase,
+    /** HistoCollection::FillGroupedCounts */
+    GroupedFillPhase,
+    /** ApplyLUT */
+    ApplyLUTPhase,
+    /** FillCountsParallel */
+    ParallelFillPhase,
+    /** FillCountsFromSources */
+    PipelineFillPhase,
+    NumberOfPhases
+};
+/** @} */
+
+/** \defgroup index_paths index_paths */
+/**@{
+ * @brief How the bin of a value is found.
+ */
+enum index_path {
+    /** Binary search in breaks. */
+    SearchIndexPath = 0,
+    /** Arithmetic index, for equidistant breaks. */
+    UniformIndexPath,
+    /** Table indexed directly by the value, for small integer data. */
+    LUTIndexPath,
+    NumberOfIndexPaths
+};
+/** @} */
+
+/**
+ * @brief Snapshot of the instrumentation statistics.
+ * All the values are zero if the instrumentation is disabled.
+ */
+struct FillStats {
+    /** True if compiled with HISTO_ENABLE_INSTRUMENTATION. */
+    bool enabled{false};
+    /** Wall time in seconds spent in each phase. @sa fill_phase */
+    double phase_seconds[NumberOfPhases] = {};
+    /** Number of times each phase has been run. */
+    unsigned long long phase_calls[NumberOfPhases] = {};
+    /** Values processed by fills and lookup tables. */
+    unsigned long long samples{0};
+    /** Values out of the range of the breaks. */
+    unsigned long long out_of_range{0};
+    /** NaN values. */
+    unsigned long long nan{0};
+    /** Values processed by each index path. @sa index_path */
+    unsigned long long index_path_samples[NumberOfIndexPaths] = {};
+    /** Number of parallel regions run. */
+    unsigned long long parallel_regions{0};
+    /** Threads used summed over parallel regions. */
+    unsigned long long parallel_threads{0};
+    /** Wall time of parallel regions times their threads, in seconds. */
+    double parallel_capacity_seconds{0};
+    /** Time the threads of parallel regions were busy, in seconds. */
+    double parallel_busy_seconds{0};
+
+    /** Busy time over available time of parallel regions, in [0, 1]. */
+    double ThreadUtilization() const {
+        return parallel_capacity_seconds > 0
+                       ? parallel_busy_seconds / parallel_capacity_seconds
+                       : 0.0;
+    }
+
+    /** @brief print statistics as a JSON object. */
+    void PrintJSON(std::ostream &os) const {
+        static const char *phase_names[NumberOfPhases] = {
+                "minmax", "variance", "balance_breaks",
+                "fill_counts", "grouped_fill", "apply_lut",
+                "parallel_fill", "pipeline_fill"};
+        static const char *path_names[NumberOfIndexPaths] = {"search",
+                                                             "uniform", "lut"};
+        os << "{\"enabled\": " << (enabled ? "true" : "false");
+        os << ", \"phases\": {";
+        for (int p = 0; p < NumberOfPhases; ++p) {
+            os << (p ? ", " : "") << "\"" << phase_names[p]
+               << "\": {\"seconds\": " << phase_seconds[p]
+               << ", \"calls\": " << phase_calls[p] << "}";
+        }
+        os << "}, \"samples\": " << samples;
+        os << ", \"out_of_range\": " << out_of_range;
+        os << ", \"nan\": " << nan;
+        os << ", \"index_path_samples\": {";
+        for (int p = 0; p < NumberOfIndexPaths; ++p) {
+            os << (p ? ", " : "") << "\"" << path_names[p]
+               << "\": " << index_path_samples[p];
+        }
+        os << "}, \"parallel_regions\": " << parallel_regions;
+        os << ", \"parallel_threads\": " << parallel_threads;
+        os << ", \"thread_utilization\": " << ThreadUtilization();
+        os << "}" << std::endl;
+    }
+};
+
+/**
+ * @brief Process-wide accumulator of the statistics, thread safe.
+ * Times are stored in nanoseconds.
+ */
+struct FillStatsAccumulator {
+    std::atomic<unsigned long long> phase_nanoseconds[NumberOfPhases];
+    std::atomic<unsigned long long> phase_calls[NumberOfPhases];
+    std::atomic<unsigned long long> samples;
+    std::atomic<unsigned long long> out_of_range;
+    std::atomic<unsigned long long> nan;
+    std::atomic<unsigned long long> index_path_samples[NumberOfIndexPaths];
+    std::atomic<unsigned long long> parallel_regions;
+    std::atomic<unsigned long long> parallel_threads;
+    std::atomic<unsigned long long> parallel_capacity_nanoseconds;
+    std::atomic<unsigned long long> parallel_busy_nanoseconds;
+
+    FillStatsAccumulator() { Reset(); }
+    void Reset() {
+        for (int p = 0; p < NumberOfPhases; ++p) {
+            phase_nanoseconds[p] = 0;
+            phase_calls[p] = 0;
+        }
+        samples = 0;
+        out_of_range = 0;
+        nan = 0;
+        for (int p = 0; p < NumberOfIndexPaths; ++p) {
+            index_path_samples[p] = 0;
+        }
+        parallel_regions = 0;
+        parallel_threads = 0;
+        parallel_capacity_nanoseconds = 0;
+        parallel_busy_nanoseconds = 0;
+    }
+};
+
+/** @brief The process-wide accumulator. */
+inline FillStatsAccumulator &FillStatsRegistry() {
+    static FillStatsAccumulator registry;
+    return registry;
+}
+
+/** @brief Nanoseconds elapsed since start. */
+inline unsigned long long
+ElapsedNanoseconds(const std::chrono::steady_clock::time_point &start) {
+    return static_cast<unsigned long long>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+}
+
+/** @brief Add the lifetime of the object to the time of a phase. */
+class ScopedPhaseTimer {
+  public:
+    explicit ScopedPhaseTimer(const fill_phase &phase)
+            : phase_(phase), start_(std::chrono::steady_clock::now()){};
+    ~ScopedPhaseTimer() {
+        auto &registry = FillStatsRegistry();
+        registry.phase_nanoseconds[phase_] += ElapsedNanoseconds(start_);
+        ++registry.phase_calls[phase_];
+    };
+    ScopedPhaseTimer(const ScopedPhaseTimer &) = delete;
+    ScopedPhaseTimer &operator=(const ScopedPhaseTimer &) = delete;
+
+  private:
+    fill_phase phase_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/** @brief Count a value that is out of range, or NaN. */
+template <typename TData>
+void RecordOutOfRange(const TData &value) {
+    if (value != value)
+        ++FillStatsRegistry().nan;
+    else
+        ++FillStatsRegistry().out_of_range;
+}
+
+/** @brief Count n values processed with an index path. */
+inline void RecordSamples(const index_path &path,
+                          const unsigned long long &n) {
+    FillStatsRegistry().samples += n;
+    FillStatsRegistry().index_path_samples[path] += n;
+}
+
+/** @brief Snapshot of the statistics accumulated since the last reset. */
+inline FillStats GetFillStats() {
+    FillStats stats;
+#ifdef HISTO_ENABLE_INSTRUMENTATION
+    const auto &registry = FillStatsRegistry();
+    stats.enabled = true;
+    for (int p = 0; p < NumberOfPhases; ++p) {
+        stats.phase_seconds[p] = registry.phase_nanoseconds[p] * 1e-9;
+        stats.phase_calls[p] = registry.phase_calls[p];
+    }
+    stats.samples = registry.samples;
+    stats.out_of_range = registry.out_of_range;
+    stats.nan = registry.nan;
+    for (int p = 0; p < NumberOfIndexPaths; ++p) {
+        stats.index_path_samples[p] = registry.index_path_samples[p];
+    }
+    stats.parallel_regions = registry.parallel_regions;
+    stats.parallel_threads = registry.parallel_threads;
+    stats.parallel_capacity_seconds =
+            registry.parallel_capacity_nanoseconds * 1e-9;
+    stats.parallel_busy_seconds = registry.parallel_busy_nanoseconds * 1e-9;
+#endif
+    return stats;
+}
+
+/** @brief Set all the statistics to zero. */
+inline void ResetFillStats() {
+#ifdef HISTO_ENABLE_INSTRUMENTATION
+    FillStatsRegistry().Reset();
+#endif
+}
+
+} // End of namespace histo
+#endif
@@ -0,0 +1,342 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_parallel.hpp
+Helpers to run histogram operations in parallel with std::thread.
+*/
+
+#ifndef HISTO_PARALLEL_HPP_
+#define HISTO_PARALLEL_HPP_
+#include "histo_instrumentation.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#ifdef HISTO_USE_NUMA
+#include <numa.h>
+#endif
+
+namespace histo {
+
+/**
+ * @brief Number of threads to use for num_items.
+ *
+ * @param num_threads requested threads, 0 uses
+ * std::thread::hardware_concurrency().
+ * @param num_items number of items to split, no more threads than items are
+ * used.
+ *
+ * @return number of threads, at least 1.
+ */
+inline unsigned int NumberOfThreads(unsigned int num_threads,
+                                    const size_t &num_items) {
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 1;
+    if (num_items < num_threads)
+        num_threads = static_cast<unsigned int>(std::max<size_t>(num_items, 1));
+    return num_threads;
+}
+
+/**
+ * @brief Split [0, num_items) in num_threads contiguous chunks, and call
+ * f(thread_id, begin, end) for each of them in its own thread.
+ * The calling thread runs the first chunk.
+ * The first exception thrown by any chunk is rethrown after all threads
+ * have finished.
+ *
+ * @param num_items number of items to split.
+ * @param num_threads number of chunks/threads, @sa NumberOfThreads.
+ * @param f callable with signature f(unsigned int, size_t, size_t).
+ */
+template <typename F>
+void ParallelForChunks(const size_t &num_items,
+                       const unsigned int &num_threads,
+                       F f) {
+    std::vector<std::exception_ptr> errors(num_threads);
+    HISTO_INSTRUMENT(const auto region_start = std::chrono::steady_clock::now());
+    auto run_chunk = [&](const unsigned int &t) {
+        HISTO_INSTRUMENT(const auto chunk_start = std::chrono::steady_clock::now());
+        const size_t begin = num_items * t / num_threads;
+        const size_t end = num_items * (t + 1) / num_threads;
+        try {
+            f(t, begin, end);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+        HISTO_INSTRUMENT(FillStatsRegistry().parallel_busy_nanoseconds +=
+                         ElapsedNanoseconds(chunk_start));
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned int t = 1; t < num_threads; ++t) {
+        threads.emplace_back(run_chunk, t);
+    }
+    run_chunk(0);
+    for (auto &th : threads) {
+        th.join();
+    }
+    HISTO_INSTRUMENT(++FillStatsRegistry().parallel_regions);
+    HISTO_INSTRUMENT(FillStatsRegistry().parallel_threads += num_threads);
+    HISTO_INSTRUMENT(FillStatsRegistry().parallel_capacity_nanoseconds +=
+                     ElapsedNanoseconds(region_start) * num_threads);
+    for (auto &e : errors) {
+        if (e)
+            std::rethrow_exception(e);
+    }
+}
+
+/**
+ * @brief CPUs of each NUMA node available to the process.
+ * Nodes without CPUs are not listed.
+ */
+struct NumaTopology {
+    /** node_cpus[node] are the cpu ids of the node. */
+    std::vector<std::vector<int>> node_cpus;
+
+    /** Number of nodes. */
+    size_t Nodes() const { return node_cpus.size(); }
+    /** Number of cpus of all the nodes. */
+    size_t Cpus() const {
+        size_t cpus = 0;
+        for (const auto &node : node_cpus)
+            cpus += node.size();
+        return cpus;
+    }
+    /** Topology restricted to the first number_of_nodes nodes. */
+    NumaTopology FirstNodes(const size_t &number_of_nodes) const {
+        NumaTopology subset;
+        subset.node_cpus.assign(
+                node_cpus.begin(),
+                node_cpus.begin() + std::min(number_of_nodes, Nodes()));
+        return subset;
+    }
+};
+
+/**
+ * @brief CPUs the process is allowed to run on.
+ * All hardware threads if the affinity cannot be queried.
+ */
+inline std::vector<int> AllowedCpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &mask))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        const int hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < hardware; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+/**
+ * @brief NUMA topology of the machine, using libnuma when compiled with
+ * HISTO_USE_NUMA (CMake option WITH_NUMA).
+ * Without libnuma, or if NUMA is not available, all the allowed cpus are
+ * reported as a single node.
+ */
+inline NumaTopology DetectNumaTopology() {
+    NumaTopology topology;
+    const auto allowed = AllowedCpus();
+#ifdef HISTO_USE_NUMA
+    if (numa_available() >= 0) {
+        struct bitmask *cpumask = numa_allocate_cpumask();
+        for (int node = 0; node <= numa_max_node(); ++node) {
+            if (numa_node_to_cpus(node, cpumask) != 0)
+                continue;
+            std::vector<int> cpus;
+            for (const int &cpu : allowed) {
+                if (numa_bitmask_isbitset(cpumask, cpu))
+                    cpus.push_back(cpu);
+            }
+            if (!cpus.empty())
+                topology.node_cpus.push_back(cpus);
+        }
+        numa_free_cpumask(cpumask);
+    }
+#endif
+    if (topology.node_cpus.empty())
+        topology.node_cpus.push_back(allowed);
+    return topology;
+}
+
+/**
+ * @brief Pin the calling thread to cpu.
+ * @return false if pinning is not supported or failed, the thread then
+ * keeps running wherever the scheduler puts it.
+ */
+inline bool PinCurrentThread(const int &cpu) {
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+/** @brief Size in bytes of a memory page. */
+inline size_t PageSize() {
+#if defined(__linux__)
+    const long page = sysconf(_SC_PAGESIZE);
+    if (page > 0)
+        return static_cast<size_t>(page);
+#endif
+    return 4096;
+}
+
+/**
+ * @brief Split the array data[0, num_items) in num_chunks contiguous chunks
+ * of similar size, with boundaries at the start of memory pages.
+ * A page is then read by one chunk only, and NUMA placement of the pages
+ * is preserved by first touch.
+ *
+ * @return num_chunks + 1 increasing boundaries, from 0 to num_items.
+ * Chunks might be empty when there are fewer pages than chunks.
+ */
+template <typename TData>
+std::vector<size_t> PageAlignedChunks(const TData *data,
+                                      const size_t &num_items,
+                                      const size_t &num_chunks) {
+    std::vector<size_t> boundaries(num_chunks + 1, num_items);
+    boundaries[0] = 0;
+    const size_t page = PageSize();
+    const auto address = reinterpret_cast<std::uintptr_t>(data);
+    const bool aligned_items = page % sizeof(TData) == 0 &&
+                               address % sizeof(TData) == 0;
+    const size_t items_per_page = aligned_items ? page / sizeof(TData) : 1;
+    // Items before the first page boundary.
+    const size_t head = aligned_items
+                                ? ((page - address % page) % page) / sizeof(TData)
+                                : 0;
+    for (size_t c = 1; c < num_chunks; ++c) {
+        const size_t even = num_items * c / num_chunks;
+        size_t boundary = even;
+        if (even > head) {
+            const size_t pages = (even - head + items_per_page / 2) / items_per_page;
+            boundary = head + pages * items_per_page;
+        } else {
+            boundary = head;
+        }
+        boundary = std::min(std::max(boundary, boundaries[c - 1]), num_items);
+        boundaries[c] = boundary;
+    }
+    return boundaries;
+}
+
+/**
+ * @brief Node of each of num_threads threads, spreading them over the nodes
+ * of topology proportionally to their cpus, in contiguous blocks.
+ */
+inline std::vector<size_t> ThreadNodes(const NumaTopology &topology,
+                                       const unsigned int &num_threads) {
+    std::vector<size_t> nodes(num_threads, 0);
+    const size_t cpus = std::max<size_t>(topology.Cpus(), 1);
+    size_t first_cpu = 0;
+    for (size_t node = 0; node < topology.Nodes(); ++node) {
+        const size_t begin = first_cpu * num_threads / cpus;
+        first_cpu += topology.node_cpus[node].size();
+        const size_t end = first_cpu * num_threads / cpus;
+        for (size_t t = begin; t < end; ++t)
+            nodes[t] = node;
+    }
+    return nodes;
+}
+
+/**
+ * @brief Cpu where to pin each thread: the threads of a node take its cpus
+ * in order, cycling when there are more threads than cpus.
+ * @param thread_nodes @sa ThreadNodes
+ */
+inline std::vector<int> ThreadCpus(const NumaTopology &topology,
+                                   const std::vector<size_t> &thread_nodes) {
+    std::vector<int> cpus(thread_nodes.size(), -1);
+    for (size_t t = 0, rank = 0; t < thread_nodes.size(); ++t) {
+        rank = (t > 0 && thread_nodes[t] == thread_nodes[t - 1]) ? rank + 1 : 0;
+        const auto &node_cpus = topology.node_cpus[thread_nodes[t]];
+        if (!node_cpus.empty())
+            cpus[t] = node_cpus[rank % node_cpus.size()];
+    }
+    return cpus;
+}
+
+/**
+ * @brief Run f(t) for t in [0, num_threads), each in its own thread pinned
+ * to cpus[t]. Negative cpus are not pinned.
+ * The calling thread runs t = 0, and its affinity is restored afterwards.
+ * The first exception is rethrown after all threads have finished.
+ */
+template <typename F>
+void ParallelForPinned(const std::vector<int> &cpus, F f) {
+    const unsigned int num_threads = static_cast<unsigned int>(cpus.size());
+    std::vector<std::exception_ptr> errors(num_threads);
+    HISTO_INSTRUMENT(const auto region_start = std::chrono::steady_clock::now());
+    auto run = [&](const unsigned int &t) {
+        HISTO_INSTRUMENT(const auto start = std::chrono::steady_clock::now());
+        try {
+            f(t);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+        HISTO_INSTRUMENT(FillStatsRegistry().parallel_busy_nanoseconds +=
+                         ElapsedNanoseconds(start));
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned int t = 1; t < num_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            PinCurrentThread(cpus[t]);
+            run(t);
+        });
+    }
+    if (num_threads > 0) {
+#if defined(__linux__)
+        cpu_set_t previous;
+        const bool restore =
+                pthread_getaffinity_np(pthread_self(), sizeof(previous),
+                                       &previous) == 0 &&
+                PinCurrentThread(cpus[0]);
+        run(0);
+        if (restore)
+            pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+#else
+        run(0);
+#endif
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    HISTO_INSTRUMENT(++FillStatsRegistry().parallel_regions);
+    HISTO_INSTRUMENT(FillStatsRegistry().parallel_threads += num_threads);
+    HISTO_INSTRUMENT(FillStatsRegistry().parallel_capacity_nanoseconds +=
+                     ElapsedNanoseconds(region_start) * num_threads);
+    for (auto &e : errors) {
+        if (e)
+            std::rethrow_exception(e);
+    }
+}
+
+} // End of namespace histo
+#endif
@@ -0,0 +1,223 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_parallel_fill.hpp
+NUMA-aware parallel fill of the counts of a @sa Histo.
+*/
+
+#ifndef HISTO_PARALLEL_FILL_HPP_
+#define HISTO_PARALLEL_FILL_HPP_
+#include "histo.hpp"
+#include "histo_parallel.hpp"
+#include <type_traits>
+#include <vector>
+
+namespace histo {
+
+/**
+ * @brief Reduce the partial counts of the threads into counts.
+ * Threads of the same node first add their partials into the partial of the
+ * first thread of the node (node-local memory), then the partials of the
+ * nodes are added into counts. Each step is split by bins between threads.
+ *
+ * @param partials partial counts of each thread, size bins.
+ * @param thread_nodes node of each thread, in contiguous blocks.
+ * @param cpus cpu where each thread is pinned.
+ * @param counts output, the partials are added to it.
+ */
+template <typename PRECI_INTEGER, typename CountsType>
+void ReducePartialsByNode(std::vector<std::vector<PRECI_INTEGER>> &partials,
+                          const std::vector<size_t> &thread_nodes,
+                          const std::vector<int> &cpus,
+                          const unsigned long int &bins,
+                          CountsType &counts) {
+    const size_t num_threads = partials.size();
+    // First and one past the last thread of each node.
+    std::vector<size_t> node_begin, node_end;
+    for (size_t t = 0; t < num_threads; ++t) {
+        if (t == 0 || thread_nodes[t] != thread_nodes[t - 1]) {
+            node_begin.push_back(t);
+            node_end.push_back(t);
+        }
+        ++node_end.back();
+    }
+    const size_t nodes = node_begin.size();
+    std::vector<size_t> thread_node_index(num_threads);
+    for (size_t k = 0; k < nodes; ++k) {
+        for (size_t t = node_begin[k]; t < node_end[k]; ++t)
+            thread_node_index[t] = k;
+    }
+
+    // Inside each node, into the partial of its first thread.
+    ParallelForPinned(cpus, [&](const unsigned int &t) {
+        const size_t k = thread_node_index[t];
+        const size_t node_threads = node_end[k] - node_begin[k];
+        if (node_threads < 2)
+            return;
+        const size_t rank = t - node_begin[k];
+        const size_t begin = bins * rank / node_threads;
+        const size_t end = bins * (rank + 1) / node_threads;
+        PRECI_INTEGER *leader = partials[node_begin[k]].data();
+        for (size_t other = node_begin[k] + 1; other < node_end[k]; ++other) {
+            const PRECI_INTEGER *partial = partials[other].data();
+            for (size_t i = begin; i < end; ++i)
+                leader[i] += partial[i];
+        }
+    });
+
+    // Across nodes, into counts.
+    auto add_nodes = [&](const size_t &begin, const size_t &end) {
+        for (size_t i = begin; i < end; ++i) {
+            PRECI_INTEGER sum = 0;
+            for (size_t k = 0; k < nodes; ++k)
+                sum += partials[node_begin[k]][i];
+            if (sum)
+                counts[i] += sum;
+        }
+    };
+    if (std::is_same<CountsType, std::vector<PRECI_INTEGER>>::value) {
+        ParallelForPinned(cpus, [&](const unsigned int &t) {
+            add_nodes(bins * t / num_threads, bins * (t + 1) / num_threads);
+        });
+    } else {
+        // Other storages are not safe for concurrent writes.
+        add_nodes(0, bins);
+    }
+}
+
+/**
+ * @brief Fill counts only from the elements of data selected by mask, in
+ * parallel. Each thread visits the mask on its own chunk of data, so
+ * masked-out elements are never read. @sa Masks, @sa FillCountsParallel
+ *
+ * With GrowingAxis or sparse storage the fill is serial,
+ * @sa Histo::FillCountsMasked, @sa IsSparseStorage.
+ *
+ * @param input_histo histogram with breaks set-up. Counts are added to.
+ * @param data values.
+ * @param n number of values.
+ * @param mask byte mask, @sa BitMask, @sa IndexRanges or @sa AllSelected.
+ * @param num_threads threads to use, 0 for all the cpus of topology.
+ * @param topology @sa DetectNumaTopology.
+ *
+ * @return Reference to input_histo.counts
+ */
+template <typename TData, typename TMask, typename PRECI,
+          typename PRECI_INTEGER,
+          template <typename...> class COUNTS_CONTAINER>
+typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType &
+FillCountsParallelMasked(
+        Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+        const TData *data,
+        const size_t &n,
+        const TMask &mask,
+        const unsigned int &num_threads = 0,
+        const NumaTopology &topology = DetectNumaTopology()) {
+    using CountsType =
+            typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType;
+    if (input_histo.growth == GrowingAxis ||
+            IsSparseStorage<CountsType>::value)
+        return input_histo.FillCountsMasked(data, n, mask);
+    HISTO_INSTRUMENT_PHASE(ParallelFillPhase);
+    CheckMask(mask, n);
+    const unsigned int nthreads = NumberOfThreads(
+            num_threads ? num_threads
+                        : static_cast<unsigned int>(topology.Cpus()),
+            n);
+    const auto thread_nodes = ThreadNodes(topology, nthreads);
+    const auto cpus = ThreadCpus(topology, thread_nodes);
+    const auto boundaries = PageAlignedChunks(data, n, nthreads);
+    const unsigned long int bins = input_histo.bins;
+
+    std::vector<std::vector<PRECI_INTEGER>> partials(nthreads);
+    ParallelForPinned(cpus, [&](const unsigned int &t) {
+        auto &partial = partials[t];
+        partial.assign(bins, PRECI_INTEGER(0));
+        HISTO_INSTRUMENT(unsigned long long selected = 0);
+        ForEachSelected(mask, boundaries[t], boundaries[t + 1],
+                        [&](const size_t &i) {
+                            partial[input_histo.IndexFromValue(data[i])]++;
+                            HISTO_INSTRUMENT(++selected);
+                        });
+        HISTO_INSTRUMENT(RecordSamples(SearchIndexPath, selected));
+    });
+    ReducePartialsByNode(partials, thread_nodes, cpus, bins,
+                         input_histo.counts);
+    return input_histo.counts;
+}
+
+/** @brief @sa FillCountsParallelMasked */
+template <typename TData, typename TMask, typename PRECI,
+          typename PRECI_INTEGER,
+          template <typename...> class COUNTS_CONTAINER>
+typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType &
+FillCountsParallelMasked(
+        Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+        const std::vector<TData> &data,
+        const TMask &mask,
+        const unsigned int &num_threads = 0,
+        const NumaTopology &topology = DetectNumaTopology()) {
+    return FillCountsParallelMasked(input_histo, data.data(), data.size(),
+                                    mask, num_threads, topology);
+}
+
+/**
+ * @brief Fill counts from n values of data, in parallel.
+ * Same result as @sa Histo::FillCounts, for large arrays on multi-socket
+ * machines.
+ *
+ * - Threads are spread over the NUMA nodes of topology, and pinned to
+ *   their cpus.
+ * - data is split in contiguous chunks at page boundaries, in thread order.
+ *   If data was initialized in parallel with the same split, each thread
+ *   reads pages of its own node.
+ * - Each thread fills its own dense partial counts, allocated and first
+ *   touched by the thread, so they live in node-local memory.
+ * - Partials are reduced inside each node first, and then across nodes.
+ *   @sa ReducePartialsByNode
+ *
+ * With GrowingAxis the fill is serial, because the breaks change. With
+ * sparse storage it is serial too, @sa IsSparseStorage.
+ *
+ * @param input_histo histogram with breaks set-up. Counts are added to.
+ * @param data values.
+ * @param n number of values.
+ * @param num_threads threads to use, 0 for all the cpus of topology.
+ * @param topology @sa DetectNumaTopology.
+ *
+ * @return Reference to input_histo.counts
+ */
+template <typename TData, typename PRECI, typename PRECI_INTEGER,
+          template <typename...> class COUNTS_CONTAINER>
+typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType &
+FillCountsParallel(Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+                   const TData *data,
+                   const size_t &n,
+                   const unsigned int &num_threads = 0,
+                   const NumaTopology &topology = DetectNumaTopology()) {
+    using CountsType =
+            typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType;
+    if (input_histo.growth == GrowingAxis ||
+            IsSparseStorage<CountsType>::value)
+        return input_histo.FillCounts(data, n);
+    return FillCountsParallelMasked(input_histo, data, n, AllSelected(),
+                                    num_threads, topology);
+}
+
+/** @brief @sa FillCountsParallel */
+template <typename TData, typename PRECI, typename PRECI_INTEGER,
+          template <typename...> class COUNTS_CONTAINER>
+typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType &
+FillCountsParallel(Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+                   const std::vector<TData> &data,
+                   const unsigned int &num_threads = 0,
+                   const NumaTopology &topology = DetectNumaTopology()) {
+    return FillCountsParallel(input_histo, data.data(), data.size(),
+                              num_threads, topology);
+}
+
+} // End of namespace histo
+#endif
@@ -0,0 +1,482 @@
+/* Copyright (C) 2019 Pablo Hernandez-Cerdan
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+@file histo_pipeline.hpp
+Fill a @sa Histo from files of raw samples, optionally compressed, with
+bounded memory: decompression threads read blocks into a small ring of
+reusable buffers, while fill threads add the completed blocks to partial
+counts.
+
+gzip files require HISTO_WITH_ZLIB (CMake option WITH_ZLIB), and zstd files
+HISTO_WITH_ZSTD (CMake option WITH_ZSTD).
+*/
+
+#ifndef HISTO_PIPELINE_HPP_
+#define HISTO_PIPELINE_HPP_
+#include "histo.hpp"
+#include "histo_parallel.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef HISTO_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HISTO_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace histo {
+/** \defgroup compression_formats compression_formats */
+/**@{
+ * @brief Formats of the files of samples. @sa OpenBlockSource
+ */
+enum compression_format {
+    /** Raw samples. */
+    NoCompression = 0,
+    /** gzip, requires HISTO_WITH_ZLIB. */
+    GzipCompression,
+    /** zstd, requires HISTO_WITH_ZSTD. */
+    ZstdCompression
+};
+/** @} */
+
+/**
+ * @brief Sequential stream of bytes, decompressed if needed.
+ */
+class BlockSource {
+  public:
+    virtual ~BlockSource() = default;
+    /**
+     * @brief Read up to capacity bytes into buffer.
+     * @return bytes read, 0 at the end of the stream.
+     */
+    virtual size_t Read(char *buffer, const size_t &capacity) = 0;
+};
+
+/** @brief Raw file. */
+class RawFileSource : public BlockSource {
+  public:
+    explicit RawFileSource(const std::string &path)
+            : file_(std::fopen(path.c_str(), "rb")) {
+        if (!file_)
+            throw histo_error("RawFileSource: cannot open " + path);
+    }
+    ~RawFileSource() override { std::fclose(file_); }
+    RawFileSource(const RawFileSource &) = delete;
+    RawFileSource &operator=(const RawFileSource &) = delete;
+
+    size_t Read(char *buffer, const size_t &capacity) override {
+        const size_t bytes = std::fread(buffer, 1, capacity, file_);
+        if (bytes < capacity && std::ferror(file_))
+            throw histo_error("RawFileSource: read error");
+        return bytes;
+    }
+
+  private:
+    std::FILE *file_;
+};
+
+#ifdef HISTO_WITH_ZLIB
+/** @brief gzip file, decompressed with zlib. */
+class GzipSource : public BlockSource {
+  public:
+    explicit GzipSource(const std::string &path)
+            : file_(gzopen(path.c_str(), "rb")) {
+        if (!file_)
+            throw histo_error("GzipSource: cannot open " + path);
+        gzbuffer(file_, 1 << 18);
+    }
+    ~GzipSource() override { gzclose(file_); }
+    GzipSource(const GzipSource &) = delete;
+    GzipSource &operator=(const GzipSource &) = delete;
+
+    size_t Read(char *buffer, const size_t &capacity) override {
+        // gzread reads at most INT_MAX bytes per call.
+        const unsigned int len = static_cast<unsigned int>(
+                std::min<size_t>(capacity, 1u << 30));
+        const int bytes = gzread(file_, buffer, len);
+        if (bytes < 0) {
+            int error = 0;
+            throw histo_error(std::string("GzipSource: ") +
+                              gzerror(file_, &error));
+        }
+        return static_cast<size_t>(bytes);
+    }
+
+  private:
+    gzFile file_;
+};
+#endif
+
+#ifdef HISTO_WITH_ZSTD
+/** @brief zstd file, decompressed with the streaming API of zstd. */
+class ZstdSource : public BlockSource {
+  public:
+    explicit ZstdSource(const std::string &path)
+            : file_(std::fopen(path.c_str(), "rb")),
+              stream_(ZSTD_createDStream()),
+              input_buffer_(ZSTD_DStreamInSize()) {
+        if (!file_ || !stream_) {
+            Close();
+            throw histo_error("ZstdSource: cannot open " + path);
+        }
+        ZSTD_initDStream(stream_);
+        input_ = {input_buffer_.data(), 0, 0};
+    }
+    ~ZstdSource() override { Close(); }
+    ZstdSource(const ZstdSource &) = delete;
+    ZstdSource &operator=(const ZstdSource &) = delete;
+
+    size_t Read(char *buffer, const size_t &capacity) override {
+        ZSTD_outBuffer output = {buffer, capacity, 0};
+        while (output.pos < output.size) {
+            if (input_.pos == input_.size) {
+                input_.size = std::fread(input_buffer_.data(), 1,
+                                         input_buffer_.size(), file_);
+                input_.pos = 0;
+                if (input_.size == 0) {
+                    if (std::ferror(file_))
+                        throw histo_error("ZstdSource: read error");
+                    if (frame_pending_)
+                        throw histo_error("ZstdSource: truncated frame");
+                    break;
+                }
+            }
+            const size_t ret = ZSTD_decompressStream(stream_, &output, &input_);
+            if (ZSTD_isError(ret))
+                throw histo_error(std::string("ZstdSource: ") +
+                                  ZSTD_getErrorName(ret));
+            frame_pending_ = ret != 0;
+        }
+        return output.pos;
+    }
+
+  private:
+    void Close() {
+        if (stream_)
+            ZSTD_freeDStream(stream_);
+        if (file_)
+            std::fclose(file_);
+    }
+    std::FILE *file_;
+    ZSTD_DStream *stream_;
+    std::vector<char> input_buffer_;
+    ZSTD_inBuffer input_;
+    bool frame_pending_{false};
+};
+#endif
+
+/**
+ * @brief Open path as a source of bytes.
+ * Throws if the format is not available in this build.
+ */
+inline std::unique_ptr<BlockSource>
+OpenBlockSource(const std::string &path, const compression_format &format) {
+    switch (format) {
+    case NoCompression:
+        return std::unique_ptr<BlockSource>(new RawFileSource(path));
+    case GzipCompression:
+#ifdef HISTO_WITH_ZLIB
+        return std::unique_ptr<BlockSource>(new GzipSource(path));
+#else
+        throw histo_error("OpenBlockSource: gzip requires HISTO_WITH_ZLIB");
+#endif
+    case ZstdCompression:
+#ifdef HISTO_WITH_ZSTD
+        return std::unique_ptr<BlockSource>(new ZstdSource(path));
+#else
+        throw histo_error("OpenBlockSource: zstd requires HISTO_WITH_ZSTD");
+#endif
+    default:
+        throw histo_error("OpenBlockSource: No Valid Format selected.");
+    }
+}
+
+/**
+ * @brief Fixed set of buffers passed between producers, that fill free
+ * buffers, and consumers, that process ready buffers and give them back.
+ * Memory is bounded by number_of_buffers * capacity.
+ */
+template <typename T>
+class BufferRing {
+  public:
+    BufferRing(const size_t &number_of_buffers, const size_t &capacity,
+               const unsigned int &producers)
+            : buffers_(number_of_buffers, std::vector<T>(capacity)),
+              producers_(producers) {
+        for (size_t b = 0; b < number_of_buffers; ++b)
+            free_.push_back(b);
+    }
+
+    T *Data(const size_t &buffer) { return buffers_[buffer].data(); }
+    size_t Capacity() const { return buffers_.front().size(); }
+
+    /** @brief Wait for a free buffer. @return false if aborted. */
+    bool AcquireFree(size_t &buffer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        free_cv_.wait(lock, [this] { return aborted_ || !free_.empty(); });
+        if (aborted_)
+            return false;
+        buffer = free_.front();
+        free_.pop_front();
+        return true;
+    }
+    /** @brief Pass the first count values of buffer to the consumers. */
+    void PushReady(const size_t &buffer, const size_t &count) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.emplace_back(buffer, count);
+        }
+        ready_cv_.notify_one();
+    }
+    /** @brief Give back a buffer. */
+    void ReleaseFree(const size_t &buffer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(buffer);
+        }
+        free_cv_.notify_one();
+    }
+    /** @brief A producer has finished. */
+    void ProducerDone() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --producers_;
+        }
+        ready_cv_.notify_all();
+    }
+    /**
+     * @brief Wait for a ready buffer.
+     * @return false if aborted, or if all producers are done and there are
+     * no ready buffers left.
+     */
+    bool PopReady(size_t &buffer, size_t &count) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_cv_.wait(lock, [this] {
+            return aborted_ || !ready_.empty() || producers_ == 0;
+        });
+        if (aborted_ || ready_.empty())
+            return false;
+        buffer = ready_.front().first;
+        count = ready_.front().second;
+        ready_.pop_front();
+        return true;
+    }
+    /** @brief Wake up and stop all producers and consumers. */
+    void Abort() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            aborted_ = true;
+        }
+        free_cv_.notify_all();
+        ready_cv_.notify_all();
+    }
+
+  private:
+    std::vector<std::vector<T>> buffers_;
+    std::deque<size_t> free_;
+    std::deque<std::pair<size_t, size_t>> ready_;
+    unsigned int producers_;
+    bool aborted_{false};
+    std::mutex mutex_;
+    std::condition_variable free_cv_;
+    std::condition_variable ready_cv_;
+};
+
+/**
+ * @brief Fill counts from sources of raw samples of type TData, overlapping
+ * reading/decompression with the fill.
+ *
+ * Each decompression thread takes the next unread source and reads it in
+ * blocks of block_bytes into free buffers of a @sa BufferRing. Each fill
+ * thread takes ready blocks and adds them to its own partial counts, which
+ * are added to counts at the end. Memory is bounded by the buffers and the
+ * partials, whatever the size of the sources.
+ *
+ * With GrowingAxis a single fill thread fills counts directly. With sparse
+ * storage (@sa IsSparseStorage) a single fill thread fills a sparse partial,
+ * instead of dense partials of size bins.
+ *
+ * @param input_histo histogram with breaks set-up. Counts are added to.
+ * @param sources streams of samples, their size must be a multiple of
+ * sizeof(TData).
+ * @param decompress_threads threads reading the sources, at most one per
+ * source.
+ * @param fill_threads threads filling, 0 for the remaining
+ * hardware_concurrency.
+ * @param block_bytes size of each buffer.
+ * @param number_of_buffers buffers of the ring, 0 for two per thread.
+ *
+ * @return Reference to input_histo.counts
+ */
+template <typename TData, typename PRECI, typename PRECI_INTEGER,
+          template <typename...> class COUNTS_CONTAINER>
+typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType &
+FillCountsFromSources(
+        Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+        std::vector<std::unique_ptr<BlockSource>> &sources,
+        const unsigned int &decompress_threads = 1,
+        const unsigned int &fill_threads = 0,
+        const size_t &block_bytes = 1 << 20,
+        const size_t &number_of_buffers = 0) {
+    HISTO_INSTRUMENT_PHASE(PipelineFillPhase);
+    const unsigned int producers =
+            NumberOfThreads(std::max(decompress_threads, 1u), sources.size());
+    unsigned int consumers = fill_threads;
+    if (consumers == 0) {
+        const unsigned int hardware = std::thread::hardware_concurrency();
+        consumers = hardware > producers ? hardware - producers : 1;
+    }
+    using CountsType =
+            typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType;
+    const bool growing = input_histo.growth == GrowingAxis;
+    const bool sparse = !growing && IsSparseStorage<CountsType>::value;
+    if (growing || sparse)
+        consumers = 1;
+    const size_t capacity = std::max<size_t>(block_bytes / sizeof(TData), 1);
+    const size_t buffers = number_of_buffers
+                                   ? number_of_buffers
+                                   : 2 * static_cast<size_t>(producers + consumers);
+    BufferRing<TData> ring(buffers, capacity, producers);
+    std::atomic<size_t> next_source{0};
+    const unsigned long int bins = input_histo.bins;
+    std::vector<std::vector<PRECI_INTEGER>> partials(
+            growing || sparse ? 0 : consumers);
+    CountsType sparse_partial(sparse ? bins : 0);
+    // O(1) index for equidistant breaks. Values on the upper border, out of
+    // range or NaN go through IndexFromValue, that handles and reports them.
+    const auto &breaks = input_histo.breaks;
+    const bool equidistant = !growing && AreBreaksEquidistant(breaks);
+    const PRECI inv_width =
+            static_cast<PRECI>(bins) / (breaks.back() - breaks.front());
+    auto index = [&](const TData &value) -> unsigned long int {
+        if (equidistant && value >= breaks.front() && value < breaks.back())
+            return IndexFromEquidistantBreaks(breaks, inv_width, value);
+        return input_histo.IndexFromValue(value);
+    };
+
+    auto produce = [&]() {
+        for (size_t s = next_source++; s < sources.size(); s = next_source++) {
+            bool end_of_source = false;
+            while (!end_of_source) {
+                size_t buffer;
+                if (!ring.AcquireFree(buffer))
+                    return;
+                char *bytes_buffer = reinterpret_cast<char *>(ring.Data(buffer));
+                const size_t capacity_bytes = capacity * sizeof(TData);
+                size_t bytes = 0;
+                while (bytes < capacity_bytes) {
+                    const size_t read = sources[s]->Read(bytes_buffer + bytes,
+                                                         capacity_bytes - bytes);
+                    if (read == 0) {
+                        end_of_source = true;
+                        break;
+                    }
+                    bytes += read;
+                }
+                if (bytes % sizeof(TData)) {
+                    ring.ReleaseFree(buffer);
+                    throw histo_error("FillCountsFromSources: source " +
+                                      std::to_string(s) +
+                                      " is not a multiple of the sample size");
+                }
+                if (bytes == 0)
+                    ring.ReleaseFree(buffer);
+                else
+                    ring.PushReady(buffer, bytes / sizeof(TData));
+            }
+        }
+    };
+    auto consume = [&](const unsigned int &c) {
+        if (!growing && !sparse)
+            partials[c].assign(bins, PRECI_INTEGER(0));
+        size_t buffer, count;
+        while (ring.PopReady(buffer, count)) {
+            const TData *block = ring.Data(buffer);
+            if (growing) {
+                input_histo.FillCounts(block, count);
+            } else {
+                if (sparse) {
+                    for (size_t i = 0; i < count; ++i)
+                        sparse_partial[index(block[i])]++;
+                } else {
+                    auto &partial = partials[c];
+                    for (size_t i = 0; i < count; ++i)
+                        partial[index(block[i])]++;
+                }
+                HISTO_INSTRUMENT(RecordSamples(
+                        equidistant ? UniformIndexPath : SearchIndexPath,
+                        count));
+            }
+            ring.ReleaseFree(buffer);
+        }
+    };
+
+    const unsigned int nthreads = producers + consumers;
+    ParallelForChunks(nthreads, nthreads, [&](const unsigned int &t,
+                                              const size_t &, const size_t &) {
+        try {
+            if (t < producers) {
+                produce();
+                ring.ProducerDone();
+            } else {
+                consume(t - producers);
+            }
+        } catch (...) {
+            ring.Abort();
+            throw;
+        }
+    });
+
+    if (sparse) {
+        ForEachCount(sparse_partial, [&](const unsigned long int &i,
+                                         const PRECI_INTEGER &c) {
+            if (c)
+                input_histo.counts[i] += c;
+        });
+    }
+    for (unsigned long int i = 0; i < bins && !growing && !sparse; ++i) {
+        PRECI_INTEGER sum = 0;
+        for (const auto &partial : partials)
+            sum += partial[i];
+        if (sum)
+            input_histo.counts[i] += sum;
+    }
+    return input_histo.counts;
+}
+
+/**
+ * @brief Fill counts from files of raw samples of type TData.
+ * @sa FillCountsFromSources, @sa OpenBlockSource
+ *
+ * @param paths files, read in parallel by up to decompress_threads.
+ * @param format compression of the files.
+ */
+template <typename TData, typename PRECI, typename PRECI_INTEGER,
+          template <typename...> class COUNTS_CONTAINER>
+typename Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER>::CountsType &
+FillCountsFromFiles(Histo<PRECI, PRECI_INTEGER, COUNTS_CONTAINER> &input_histo,
+                    const std::vector<std::string> &paths,
+                    const compression_format &format,
+                    const unsigned int &decompress_threads = 1,
+                    const unsigned int &fill_threads = 0,
+                    const size_t &block_bytes = 1 << 20,
+                    const size_t &number_of_buffers = 0) {
+    std::vector<std::unique_ptr<BlockSource>> sources;
+    for (const auto &path : paths)
+        sources.push_back(OpenBlockSource(path, format));
+    return FillCountsFromSources<TData>(input_histo, sources,
+                                        decompress_threads, fill_threads,
+                                        block_bytes, number_of_buffers);
+}
+
+} // End of namespace histo
+#endif
@@ -20,6 +20,12 @@
 #include <vtkRenderWindowInteractor.h>
 #include <vtkAxis.h>
 #include <vtkPlot.h>
+#include <vtkAOSDataArrayTemplate.h>
+#include <vtkUnsignedCharArray.h>
+#include <vtkWindowToImageFilter.h>
+#include <vtkPNGWriter.h>
+#include <type_traits>
+#include <vector>
 
 namespace histo {
 
@@ -27,23 +33,29 @@ template<typename THisto>
 vtkSmartPointer<vtkChartXY> chart_from_histogram(
         const THisto & input_histo, vtkIdType chart_type = vtkChart::LINE )
 {
+    using PreciType = typename THisto::BreaksType::value_type;
+    using CountType = typename THisto::CountsType::value_type;
     auto chart = vtkSmartPointer<vtkChartXY>::New();
     vtkNew<vtkTable> table;
     table->SetNumberOfRows(input_histo.bins);
-    vtkNew<vtkFloatArray> xArray ;
+    // Native precision of breaks and counts, no narrowing to float.
+    vtkNew<vtkAOSDataArrayTemplate<PreciType>> xArray ;
     xArray->SetName("Bins");
     xArray->SetNumberOfValues(input_histo.bins);
     table->AddColumn(xArray.GetPointer());
-    vtkNew<vtkFloatArray> yArray;
+    vtkNew<vtkAOSDataArrayTemplate<CountType>> yArray;
     yArray->SetName("Counts");
     yArray->SetNumberOfValues(input_histo.bins);
     table->AddColumn(yArray.GetPointer());
 
-    auto centers = input_histo.ComputeBinCenters();
     for (size_t j = 0; j != input_histo.bins; j++){
-        xArray->SetValue(j, centers[j]);
-        yArray->SetValue(j, input_histo.counts[j]);
+        xArray->SetValue(j, input_histo.ComputeBinCenter(j));
+        yArray->SetValue(j, CountType(0));
     }
+    ForEachCount(input_histo.counts,
+            [&yArray](const unsigned long int & j, const CountType & c) {
+            yArray->SetValue(j, c);
+            });
     // auto const &xAxis = chart->GetAxis(vtkAxis::BOTTOM) ;
     // xAxis->SetRange(input_histo.range.first, input_histo.range.second);
     // xAxis->SetTitle(input_histo.name);
@@ -57,6 +69,166 @@ vtkSmartPointer<vtkChartXY> chart_from_histogram(
     points->SetInputData(table, 0 , 1);
     return chart;
 }
+
+/**
+ * Chart wrapping the counts of a histogram without copying them.
+ * The counts are used in their native precision with
+ * vtkAOSDataArrayTemplate::SetArray, and the bin centers are computed once.
+ *
+ * The histogram must outlive the chart, and its counts must be a
+ * std::vector. After modifying the counts, call Update() to redraw them
+ * in place. If the counts were reallocated or the breaks changed
+ * (i.e. a growing axis), Update() wraps the new memory.
+ */
+template<typename THisto>
+class HistoChart {
+  public:
+    using PreciType = typename THisto::BreaksType::value_type;
+    using CountType = typename THisto::CountsType::value_type;
+    static_assert(std::is_same<typename THisto::CountsType,
+            std::vector<CountType>>::value,
+            "HistoChart requires contiguous counts, use chart_from_histogram.");
+
+    HistoChart(const THisto & input_histo,
+            vtkIdType chart_type = vtkChart::LINE)
+        : histo_(input_histo)
+    {
+        x_array_->SetName("Bins");
+        y_array_->SetName("Counts");
+        table_->AddColumn(x_array_);
+        table_->AddColumn(y_array_);
+        chart_->GetAxis(vtkAxis::LEFT)->SetTitle("#");
+        chart_->GetAxis(vtkAxis::BOTTOM)->SetTitle("bins");
+        chart_->SetTitle(histo_.name);
+        Wrap();
+        chart_->AddPlot(chart_type)->SetInputData(table_, 0, 1);
+    }
+
+    vtkChartXY * GetChart() const { return chart_; }
+
+    /** Redraw the counts in place, wrapping them again if they moved or
+     * any break changed. */
+    void Update()
+    {
+        if (histo_.counts.data() != wrapped_counts_ ||
+                histo_.counts.size() != wrapped_bins_ ||
+                histo_.breaks != wrapped_breaks_) {
+            Wrap();
+        } else {
+            y_array_->Modified();
+        }
+        table_->Modified();
+        chart_->SetTitle(histo_.name);
+    }
+
+  private:
+    void Wrap()
+    {
+        centers_ = histo_.ComputeBinCenters();
+        wrapped_counts_ = histo_.counts.data();
+        wrapped_bins_ = histo_.counts.size();
+        wrapped_breaks_ = histo_.breaks;
+        // save = 1: VTK does not own, nor free, the memory.
+        x_array_->SetArray(centers_.data(), centers_.size(), 1);
+        y_array_->SetArray(const_cast<CountType *>(wrapped_counts_),
+                wrapped_bins_, 1);
+        x_array_->Modified();
+        y_array_->Modified();
+    }
+
+    const THisto & histo_;
+    typename THisto::BreaksType centers_;
+    const CountType * wrapped_counts_{nullptr};
+    size_t wrapped_bins_{0};
+    /** Breaks of the centers, a merge can keep the size and both ends. */
+    typename THisto::BreaksType wrapped_breaks_;
+    vtkSmartPointer<vtkAOSDataArrayTemplate<PreciType>> x_array_ =
+        vtkSmartPointer<vtkAOSDataArrayTemplate<PreciType>>::New();
+    vtkSmartPointer<vtkAOSDataArrayTemplate<CountType>> y_array_ =
+        vtkSmartPointer<vtkAOSDataArrayTemplate<CountType>>::New();
+    vtkSmartPointer<vtkTable> table_ = vtkSmartPointer<vtkTable>::New();
+    vtkSmartPointer<vtkChartXY> chart_ = vtkSmartPointer<vtkChartXY>::New();
+};
+
+/**
+ * Headless renderer of charts to PNG images in memory.
+ * The offscreen render window is reused between renders, so thousands of
+ * snapshots can be rendered in batch.
+ */
+class HistoPNGRenderer {
+  public:
+    HistoPNGRenderer(size_t size_x = 640, size_t size_y = 480)
+    {
+        view_->GetRenderer()->SetBackground(1.0, 1.0, 1.0);
+        view_->GetRenderWindow()->SetOffScreenRendering(1);
+        view_->GetRenderWindow()->SetSize( size_x, size_y );
+        window_to_image_->SetInput(view_->GetRenderWindow());
+        window_to_image_->ReadFrontBufferOff();
+        writer_->WriteToMemoryOn();
+        writer_->SetInputConnection(window_to_image_->GetOutputPort());
+    }
+
+    /** Render the chart and return the PNG file content. */
+    std::vector<unsigned char> Render(vtkChartXY * chart)
+    {
+        view_->GetScene()->ClearItems();
+        view_->GetScene()->AddItem(chart);
+        view_->GetRenderWindow()->Render();
+        window_to_image_->Modified();
+        writer_->Write();
+        vtkUnsignedCharArray * result = writer_->GetResult();
+        const unsigned char * begin = result->GetPointer(0);
+        return std::vector<unsigned char>(begin,
+                begin + result->GetNumberOfValues());
+    }
+
+    /** Render the chart of a histogram. @sa chart_from_histogram */
+    template<typename THisto>
+    std::vector<unsigned char> Render(const THisto & input_histo,
+            vtkIdType chart_type = vtkChart::LINE)
+    {
+        auto chart = chart_from_histogram(input_histo, chart_type);
+        return Render(chart.GetPointer());
+    }
+
+  private:
+    vtkSmartPointer<vtkContextView> view_ =
+        vtkSmartPointer<vtkContextView>::New();
+    vtkSmartPointer<vtkWindowToImageFilter> window_to_image_ =
+        vtkSmartPointer<vtkWindowToImageFilter>::New();
+    vtkSmartPointer<vtkPNGWriter> writer_ =
+        vtkSmartPointer<vtkPNGWriter>::New();
+};
+
+/**
+ * Render histogram offscreen to a PNG image in memory, without window.
+ * Use @sa HistoPNGRenderer to render many histograms.
+ *
+ * @param input histo
+ * @return content of the PNG file.
+ */
+template<typename THisto>
+std::vector<unsigned char> render_histo_to_png(const THisto & input_histo,
+        vtkIdType chart_type = vtkChart::LINE,
+        size_t size_x = 640,
+        size_t size_y = 480)
+{
+    HistoPNGRenderer renderer(size_x, size_y);
+    return renderer.Render(input_histo, chart_type);
+}
+
+/**
+ * Chart of the finest level of the pyramid with at most max_bins bins.
+ * @sa HistoPyramid::LevelForMaxBins
+ */
+template<typename THistoPyramid>
+vtkSmartPointer<vtkChartXY> chart_from_pyramid(
+        const THistoPyramid & input_pyramid, size_t max_bins,
+        vtkIdType chart_type = vtkChart::LINE )
+{
+    return chart_from_histogram(
+            input_pyramid.LevelForMaxBins(max_bins), chart_type);
+}
    /**
     * Visualize histogram using VTK chart.
     *
@@ -3,6 +3,7 @@
 #include <memory>
 #include <iostream>
 #include <random>
+#include <sstream>
 using namespace testing;
 using namespace std;
 using namespace histo;
@@ -231,3 +232,335 @@ TEST(NormalizeByArea, withJustData ) {
     EXPECT_FLOAT_EQ(counts[3], 1.0 / sum_areas);
     EXPECT_FLOAT_EQ(counts[19], 1.0/ sum_areas);
 }
+
+TEST(SparseCounts, OnlyOccupiedBinsAreStored) {
+    const unsigned long int input_bins = 10000000;
+    vector<double> data{1.0, 1.0, 2.5, 9999998.5};
+    Histo<double, unsigned long int, SparseCounts> h(
+        data, histo::GenerateBreaksFromRangeAndBins<double>(0.0, 10000000.0,
+                                                            input_bins));
+    EXPECT_EQ(input_bins, h.counts.size());
+    EXPECT_EQ(3, h.counts.occupied());
+    EXPECT_FALSE(h.counts.is_dense());
+    EXPECT_EQ(2, h.counts[1]);
+    EXPECT_EQ(1, h.counts[2]);
+    EXPECT_EQ(0, h.counts[3]);
+    EXPECT_EQ(1, h.counts[9999998]);
+    h.Increase(3);
+    EXPECT_EQ(1, h.counts[3]);
+    h.Decrease(3);
+    EXPECT_EQ(0, h.counts[3]);
+
+    std::ostringstream os;
+    h.PrintCentersAndCounts(os);
+    std::string line;
+    std::istringstream is(os.str());
+    size_t lines = 0;
+    while (std::getline(is, line)) {
+        ++lines;
+    }
+    EXPECT_EQ(3, lines);
+}
+
+TEST(SparseCounts, ReadingBinsDoesNotInsertThem) {
+    vector<double> data{1.5, 7.5};
+    Histo<double, unsigned long int, SparseCounts> h(
+        data, histo::GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 100));
+    unsigned long int total = 0;
+    for (unsigned long int i = 0; i < h.bins; i++) {
+        total += h.counts[i];
+    }
+    EXPECT_EQ(2, total);
+    EXPECT_FALSE(h.counts.is_dense());
+    EXPECT_EQ(2, h.counts.occupied());
+    h.counts[20] = 0;
+    EXPECT_EQ(2, h.counts.occupied());
+    EXPECT_ANY_THROW(h.Decrease(5));
+    EXPECT_EQ(2, h.counts.occupied());
+    EXPECT_ANY_THROW(h.SetCount(100, 1));
+    h.Decrease(1);
+    EXPECT_EQ(0, h.GetCount(1));
+    // The cached order is updated after inserting bins.
+    vector<unsigned long int> visited;
+    h.counts.for_each_occupied(
+        [&visited](const unsigned long int &i, const unsigned long int &) {
+            visited.push_back(i);
+        });
+    EXPECT_THAT(visited, ElementsAre(7));
+    h.counts[3] += 2;
+    visited.clear();
+    h.counts.for_each_occupied(
+        [&visited](const unsigned long int &i, const unsigned long int &) {
+            visited.push_back(i);
+        });
+    EXPECT_THAT(visited, ElementsAre(3, 7));
+}
+
+TEST(SparseCounts, SwitchToDenseWhenOccupancyIsHigh) {
+    vector<double> data{0.5, 1.5, 2.5, 3.5, 4.5, 5.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 20.0, 20);
+    Histo<double, unsigned long int, SparseCounts> h_sparse(data, breaks);
+    Histo<double> h_dense(data, breaks);
+    EXPECT_TRUE(h_sparse.counts.is_dense());
+    for (unsigned long int i = 0; i < h_dense.bins; i++) {
+        EXPECT_EQ(h_dense.counts[i], h_sparse.counts[i]);
+    }
+    h_sparse.ResetCounts();
+    EXPECT_FALSE(h_sparse.counts.is_dense());
+    EXPECT_EQ(0, h_sparse.counts.occupied());
+}
+
+TEST(SparseCounts, MeanAndNormalizeMatchDense) {
+    vector<double> data{1.0, 1.0, 2.0, 3.0, 19.0};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 20.0, 1.0);
+    Histo<double, unsigned long int, SparseCounts> h_sparse(data, breaks);
+    Histo<double> h_dense(data, breaks);
+    EXPECT_FALSE(h_sparse.counts.is_dense());
+    EXPECT_FLOAT_EQ(Mean(h_dense), Mean(h_sparse));
+    auto norm_sparse = NormalizeByArea(h_sparse);
+    auto norm_dense = NormalizeByArea(h_dense);
+    EXPECT_EQ(4, norm_sparse.counts.occupied());
+    for (unsigned long int i = 0; i < h_dense.bins; i++) {
+        EXPECT_FLOAT_EQ(norm_dense.counts[i], norm_sparse.counts[i]);
+    }
+}
+
+TEST(AdaptiveCounts, PromotesPagesOnOverflow) {
+    AdaptiveCounts<unsigned long int> counts(3 * AdaptiveCounts<unsigned long int>::page_size);
+    EXPECT_EQ(1, counts.width(0));
+    for (unsigned int i = 0; i < 255; i++) {
+        counts[1]++;
+    }
+    EXPECT_EQ(255, counts[1]);
+    EXPECT_EQ(1, counts.width(1));
+    ++counts[1];
+    EXPECT_EQ(256, counts[1]);
+    EXPECT_EQ(2, counts.width(1));
+    // Other pages are not promoted.
+    EXPECT_EQ(1, counts.width(AdaptiveCounts<unsigned long int>::page_size));
+    counts[2] = numeric_limits<unsigned int>::max();
+    counts[2]++;
+    EXPECT_EQ(8, counts.width(2));
+    EXPECT_EQ(static_cast<unsigned long int>(numeric_limits<unsigned int>::max()) + 1, counts[2]);
+    counts[2]--;
+    EXPECT_EQ(numeric_limits<unsigned int>::max(), counts[2]);
+    counts.resize(10);
+    counts.resize(20);
+    EXPECT_EQ(0, counts[15]);
+    EXPECT_EQ(256, counts[1]);
+}
+
+TEST(AdaptiveCounts, HistoMatchesDense) {
+    std::vector<unsigned short> data(10000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (i % 7 == 0) ? 3 : i % 100;
+    }
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(-0.5, 99.5, 100);
+    Histo<double, unsigned long int, AdaptiveCounts> h_adaptive(data, breaks);
+    Histo<double> h_dense(data, breaks);
+    EXPECT_EQ(2, h_adaptive.counts.width(3));
+    for (unsigned long int i = 0; i < h_dense.bins; i++) {
+        EXPECT_EQ(h_dense.counts[i], h_adaptive.counts[i]);
+    }
+    EXPECT_FLOAT_EQ(Mean(h_dense), Mean(h_adaptive));
+    auto norm_adaptive = NormalizeByArea(h_adaptive);
+    auto norm_dense = NormalizeByArea(h_dense);
+    for (unsigned long int i = 0; i < h_dense.bins; i++) {
+        EXPECT_FLOAT_EQ(norm_dense.counts[i], norm_adaptive.counts[i]);
+    }
+    // Increase still throws at the limit of PRECI_INTEGER.
+    Histo<double, unsigned char, AdaptiveCounts> h_small(data, breaks);
+    h_small.SetCount(0, numeric_limits<unsigned char>::max());
+    EXPECT_THROW(h_small.Increase(0), histo_error);
+}
+
+TEST(Rebin, WithFactorPreservesCounts) {
+    vector<double> data{1.0, 1.0, 2.0, 3.0, 19.0, 9.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 20.0, 1.0);
+    Histo<double> h(data, breaks);
+    auto h3 = Rebin(h, 3);
+    EXPECT_EQ(7, h3.bins);
+    EXPECT_EQ(8, h3.breaks.size());
+    EXPECT_FLOAT_EQ(0.0, h3.breaks[0]);
+    EXPECT_FLOAT_EQ(3.0, h3.breaks[1]);
+    EXPECT_FLOAT_EQ(20.0, h3.breaks[7]);
+    EXPECT_EQ(3, h3.counts[0]);
+    EXPECT_EQ(1, h3.counts[1]);
+    EXPECT_EQ(1, h3.counts[3]);
+    EXPECT_EQ(1, h3.counts[6]);
+    EXPECT_THROW(Rebin(h, 0), histo_error);
+
+    Histo<double, unsigned long int, SparseCounts> h_sparse(data, breaks);
+    auto h_sparse3 = Rebin(h_sparse, 3);
+    for (unsigned long int i = 0; i < h3.bins; i++) {
+        EXPECT_EQ(h3.counts[i], h_sparse3.counts[i]);
+    }
+}
+
+TEST(Rebin, WithBreaksRedistributesCounts) {
+    vector<double> data{0.5, 1.5, 1.5, 2.5, 3.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double> h(data, breaks);
+    // Aligned edges: exact.
+    auto aligned = Rebin(h, std::vector<double>{0.0, 2.0, 4.0});
+    EXPECT_DOUBLE_EQ(3.0, aligned.counts[0]);
+    EXPECT_DOUBLE_EQ(2.0, aligned.counts[1]);
+    // Unaligned edges: proportional.
+    auto unaligned = Rebin(h, std::vector<double>{0.0, 1.5, 4.0});
+    EXPECT_DOUBLE_EQ(1.0 + 1.0, unaligned.counts[0]);
+    EXPECT_DOUBLE_EQ(1.0 + 2.0, unaligned.counts[1]);
+    EXPECT_THROW(Rebin(h, std::vector<double>{0.5, 4.0}), histo_error);
+    EXPECT_THROW(Rebin(h, std::vector<double>{0.0, 3.0, 2.0, 4.0}), histo_error);
+}
+
+TEST(HistoPyramid, LevelsHalveTheBins) {
+    vector<double> data{1.0, 1.0, 2.0, 3.0, 19.0, 9.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 20.0, 1000);
+    Histo<double> h(data, breaks);
+    HistoPyramid<double> pyramid(h);
+    EXPECT_EQ(11, pyramid.size());
+    EXPECT_EQ(1000, pyramid.Level(0).bins);
+    EXPECT_EQ(500, pyramid.Level(1).bins);
+    EXPECT_EQ(63, pyramid.Level(4).bins);
+    EXPECT_EQ(1, pyramid.Level(10).bins);
+    EXPECT_EQ(6, pyramid.Level(10).counts[0]);
+    EXPECT_EQ(4, pyramid.LevelIndexForMaxBins(63));
+    EXPECT_EQ(5, pyramid.LevelIndexForMaxBins(62));
+    EXPECT_EQ(0, pyramid.LevelIndexForMaxBins(5000));
+    EXPECT_EQ(10, pyramid.LevelIndexForMaxBins(0));
+    EXPECT_EQ(250, pyramid.LevelForMaxBins(300).bins);
+    EXPECT_THROW(pyramid.Level(11), histo_error);
+}
+
+TEST(AxisGrowth, ExtendsBinsAtBothEnds) {
+    vector<double> data{0.5, 1.5, 1.5, 3.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double> h(data, breaks);
+    EXPECT_THROW(h.FillCounts(vector<double>{4.5}), histo_error);
+    h.SetAxisGrowth(GrowingAxis);
+    h.FillCounts(vector<double>{4.5});
+    // Doubles the bins.
+    EXPECT_EQ(8, h.bins);
+    EXPECT_FLOAT_EQ(8.0, h.breaks[8]);
+    EXPECT_FLOAT_EQ(8.0, h.range.second);
+    h.FillCounts(vector<double>{-30.0});
+    EXPECT_EQ(39, h.bins);
+    EXPECT_FLOAT_EQ(-31.0, h.breaks[0]);
+    EXPECT_EQ(h.bins + 1, h.breaks.size());
+    EXPECT_EQ(1, h.counts[h.IndexFromValue(-30.0)]);
+    EXPECT_EQ(1, h.counts[h.IndexFromValue(0.5)]);
+    EXPECT_EQ(2, h.counts[h.IndexFromValue(1.5)]);
+    EXPECT_EQ(1, h.counts[h.IndexFromValue(3.5)]);
+    EXPECT_EQ(1, h.counts[h.IndexFromValue(4.5)]);
+    EXPECT_THROW(h.FillCounts(vector<double>{std::nan("")}), histo_error);
+}
+
+TEST(AxisGrowth, MergesPairsOfBinsAtMaxBins) {
+    vector<double> data{0.5, 1.5, 1.5, 3.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double, unsigned long int, SparseCounts> h(data, breaks);
+    h.SetAxisGrowth(GrowingAxis, 6);
+    h.FillCounts(vector<double>{5.5});
+    EXPECT_EQ(6, h.bins);
+    EXPECT_FLOAT_EQ(6.0, h.breaks[6]);
+    h.FillCounts(vector<double>{100.0});
+    EXPECT_LE(h.bins, 6);
+    EXPECT_FLOAT_EQ(0.0, h.breaks[0]);
+    const double width = h.breaks[1] - h.breaks[0];
+    EXPECT_FLOAT_EQ(32.0, width);
+    EXPECT_GE(h.breaks[h.bins], 100.0);
+    unsigned long int total = 0;
+    h.counts.for_each_occupied([&total](const unsigned long int &,
+                                        const unsigned long int &c) { total += c; });
+    EXPECT_EQ(6, total);
+    EXPECT_EQ(5, h.counts[0]);
+    EXPECT_EQ(1, h.counts[3]);
+
+    vector<double> non_equidistant_breaks{0.0, 1.0, 3.0};
+    Histo<double> h_non_equidistant(vector<double>{0.5, 2.5}, non_equidistant_breaks);
+    EXPECT_THROW(h_non_equidistant.SetAxisGrowth(GrowingAxis), histo_error);
+}
+
+TEST(AxisGrowth, RejectsNonFiniteAndUnreachableValues) {
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double> h(vector<double>{0.5}, breaks);
+    h.SetAxisGrowth(GrowingAxis);
+    const double inf = std::numeric_limits<double>::infinity();
+    EXPECT_THROW(h.FillCounts(vector<double>{inf}), histo_error);
+    EXPECT_THROW(h.FillCounts(vector<double>{-inf}), histo_error);
+    // Too many bins of the current width, without max_bins.
+    EXPECT_THROW(h.FillCounts(vector<double>{1e300}), histo_error);
+    EXPECT_EQ(4, h.bins);
+    // With max_bins, the width grows instead.
+    h.SetAxisGrowth(GrowingAxis, 8);
+    h.FillCounts(vector<double>{1e300, -1e300});
+    EXPECT_LE(h.bins, 8);
+    EXPECT_LE(h.breaks.front(), -1e300);
+    EXPECT_GE(h.breaks.back(), 1e300);
+}
+
+TEST(AxisGrowth, MaxBinsOfOneIsRejected) {
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double> h(vector<double>{0.5}, breaks);
+    EXPECT_THROW(h.SetAxisGrowth(GrowingAxis, 1), histo_error);
+    // Two bins can still move the low edge towards the value.
+    h.SetAxisGrowth(GrowingAxis, 2);
+    h.FillCounts(vector<double>{-10.0});
+    EXPECT_LE(h.bins, 2);
+    EXPECT_LE(h.breaks.front(), -10.0);
+    EXPECT_EQ(1, h.counts[h.IndexFromValue(-10.0)]);
+}
+
+TEST(FillCountsMasked, ByteBitAndRangeMasksMatchCopy) {
+    vector<double> data(1000);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<double>((i * 37) % 100);
+    // Masked-out values are out of range, they must not be read.
+    data[3] = -1.0;
+    data[999] = 1e9;
+    vector<unsigned char> byte_mask(data.size(), 0);
+    vector<std::uint64_t> words((data.size() + 63) / 64, 0);
+    IndexRanges ranges{{10, 20}, {64, 200}, {500, 501}, {700, 999}};
+    vector<double> selected;
+    for (const auto &r : ranges) {
+        for (size_t i = r.first; i < r.second; ++i) {
+            byte_mask[i] = 1;
+            words[i / 64] |= std::uint64_t(1) << (i % 64);
+            selected.push_back(data[i]);
+        }
+    }
+    const auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 10);
+    Histo<double> h_copy(selected, breaks);
+
+    Histo<double> h_byte(vector<double>(), breaks);
+    h_byte.FillCountsMasked(data, byte_mask);
+    EXPECT_EQ(h_copy.counts, h_byte.counts);
+    Histo<double> h_bit(vector<double>(), breaks);
+    h_bit.FillCountsMasked(data.data(), data.size(), BitMask{words.data()});
+    EXPECT_EQ(h_copy.counts, h_bit.counts);
+    Histo<double> h_ranges(vector<double>(), breaks);
+    h_ranges.FillCountsMasked(data, ranges);
+    EXPECT_EQ(h_copy.counts, h_ranges.counts);
+}
+
+TEST(FillCountsMasked, InvalidMasksThrow) {
+    vector<double> data{1.0, 2.0, 3.0};
+    Histo<double> h(vector<double>(), histo::GenerateBreaksFromRangeAndBins<double>(0.0, 4.0, 4));
+    EXPECT_ANY_THROW(h.FillCountsMasked(data, vector<unsigned char>{1, 1}));
+    EXPECT_ANY_THROW(h.FillCountsMasked(data, IndexRanges{{0, 4}}));
+    EXPECT_ANY_THROW(h.FillCountsMasked(data, IndexRanges{{2, 1}}));
+    EXPECT_NO_THROW(h.FillCountsMasked(data, IndexRanges{{0, 3}}));
+}
+
+TEST(FillCountsMasked, RangesMustBeSortedAndNotOverlap) {
+    vector<double> data{1.0, 2.0, 3.0, 3.5, 0.5};
+    Histo<double> h(vector<double>(), histo::GenerateBreaksFromRangeAndBins<double>(0.0, 4.0, 4));
+    EXPECT_THROW(h.FillCountsMasked(data, IndexRanges{{2, 4}, {0, 1}}), histo_error);
+    EXPECT_THROW(h.FillCountsMasked(data, IndexRanges{{0, 3}, {2, 5}}), histo_error);
+    EXPECT_THROW(h.FillCountsMasked(data, IndexRanges{{1, 2}, {1, 2}}), histo_error);
+    // Nothing is filled when the mask is rejected.
+    EXPECT_EQ(vector<unsigned long int>(4, 0), h.counts);
+    // Adjacent and empty ranges are valid.
+    h.FillCountsMasked(data, IndexRanges{{0, 2}, {2, 2}, {2, 3}, {4, 5}});
+    EXPECT_EQ(vector<unsigned long int>({1, 1, 1, 1}), h.counts);
+}
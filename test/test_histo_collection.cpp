@@ -0,0 +1,178 @@
+#include "gmock/gmock.h"
+#include "histo_collection.hpp"
+#include <memory>
+#include <iostream>
+#include <random>
+#include <cstdint>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+using namespace testing;
+using namespace std;
+using namespace histo;
+
+TEST(HistoCollectionGrouped, MatchesOneHistoPerLabel){
+    const unsigned long int number_of_labels = 50;
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 256.0, 64);
+    default_random_engine generator;
+    uniform_real_distribution<double> values_dist(0.0, 256.0);
+    uniform_int_distribution<int> labels_dist(0, number_of_labels - 1);
+    vector<double> data(100000);
+    vector<int> labels(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = values_dist(generator);
+        labels[i] = labels_dist(generator);
+    }
+    HistoCollection<double> collection(data, labels, breaks, number_of_labels, 4);
+    EXPECT_EQ(64, collection.bins);
+    EXPECT_EQ(64, collection.stride);
+
+    for (unsigned long int label = 0; label < number_of_labels; label++) {
+        vector<double> data_label;
+        for (size_t i = 0; i < data.size(); i++) {
+            if (labels[i] == static_cast<int>(label))
+                data_label.push_back(data[i]);
+        }
+        Histo<double> expected(data_label, breaks);
+        auto view = collection.View(label);
+        EXPECT_EQ(&collection.breaks, &view.breaks);
+        EXPECT_EQ(collection.CountsOf(label), view.counts.data());
+        for (unsigned long int b = 0; b < expected.bins; b++) {
+            EXPECT_EQ(expected.counts[b], view.counts[b]);
+        }
+        EXPECT_EQ(expected.counts, view.ToHisto().counts);
+    }
+}
+
+TEST(HistoCollectionGrouped, SerialAndParallelAreEqual){
+    vector<double> data{1.0, 1.0, 2.0, 3.0, 19.0, 5.0};
+    vector<unsigned short> labels{0, 1, 0, 2, 2, 1};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 20.0, 1.0);
+    HistoCollection<double> serial(data, labels, breaks, 3, 1);
+    HistoCollection<double> parallel(data, labels, breaks, 3, 3);
+    for (unsigned long int h = 0; h < serial.number_of_histograms; h++) {
+        EXPECT_EQ(serial.View(h).ToHisto().counts, parallel.View(h).ToHisto().counts);
+    }
+    EXPECT_EQ(1, serial.View(0).counts[1]);
+    EXPECT_EQ(1, serial.View(0).counts[2]);
+    EXPECT_EQ(1, serial.View(1).counts[5]);
+    EXPECT_EQ(1, serial.View(2).counts[19]);
+    EXPECT_THROW(serial.View(3), histo_error);
+}
+
+TEST(HistoCollectionGrouped, ThrowsOnInvalidInput){
+    vector<double> data{1.0, 2.0, 3.0, 4.0};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 5.0, 1.0);
+    HistoCollection<double> collection(breaks, 2);
+    vector<int> bad_label{0, 1, 2, 0};
+    EXPECT_THROW(collection.FillGroupedCounts(data, bad_label, 2), histo_error);
+    vector<int> short_labels{0, 1};
+    EXPECT_THROW(collection.FillGroupedCounts(data, short_labels), histo_error);
+    vector<double> out_of_range{1.0, 2.0, 3.0, 40.0};
+    vector<int> labels{0, 1, 0, 1};
+    EXPECT_THROW(collection.FillGroupedCounts(out_of_range, labels, 2), histo_error);
+    vector<int> negative_label{0, -1, 0, 1};
+    EXPECT_THROW(collection.FillGroupedCounts(data, negative_label, 2), histo_error);
+    vector<unsigned char> unsigned_bad_label{0, 1, 255, 0};
+    EXPECT_THROW(collection.FillGroupedCounts(data, unsigned_bad_label, 2), histo_error);
+}
+
+TEST(HistoCollectionGrouped, ThrowsAndKeepsCounts){
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 5.0, 1.0);
+    HistoCollection<double> collection(breaks, 2);
+    collection.FillGroupedCounts(vector<double>{0.5, 1.5, 4.5}, vector<int>{0, 1, 1}, 1);
+    auto snapshot = [&collection]() {
+        vector<unsigned long int> counts;
+        for (unsigned long int h = 0; h < collection.number_of_histograms; ++h)
+            counts.insert(counts.end(), collection.CountsOf(h),
+                          collection.CountsOf(h) + collection.bins);
+        return counts;
+    };
+    const auto expected = snapshot();
+    vector<double> data{1.0, 2.0, 3.0, 4.0};
+    for (const unsigned int threads : {1u, 2u}) {
+        EXPECT_THROW(collection.FillGroupedCounts(data, vector<int>{0, 1, 0, 2}, threads),
+                     histo_error);
+        EXPECT_EQ(expected, snapshot()) << threads;
+        EXPECT_THROW(collection.FillGroupedCounts(vector<double>{1.0, 2.0, 3.0, 40.0},
+                                                  vector<int>{0, 1, 0, 1}, threads),
+                     histo_error);
+        EXPECT_EQ(expected, snapshot()) << threads;
+    }
+}
+
+TEST(HistoCollectionGrouped, UnsignedLabelsAreReadPerHistogram){
+    vector<double> data{0.5, 1.5, 1.5, 4.5, 2.5};
+    vector<unsigned char> labels{0, 1, 1, 0, 1};
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 5.0, 5);
+    HistoCollection<double> collection(breaks, 2);
+    collection.FillGroupedCounts(data, labels, 1);
+    EXPECT_THAT(collection.View(0).ToHisto().counts, ElementsAre(1, 0, 0, 0, 1));
+    EXPECT_THAT(collection.View(1).ToHisto().counts, ElementsAre(0, 2, 1, 0, 0));
+}
+
+TEST(HistoCollection, CountsOfEachHistogramAreAligned){
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 10.0, 10);
+    HistoCollection<double> collection(breaks, 7);
+    EXPECT_EQ(16, collection.stride);
+    for (unsigned long int h = 0; h < collection.number_of_histograms; h++) {
+        const auto address = reinterpret_cast<std::uintptr_t>(collection.CountsOf(h));
+        EXPECT_EQ(0, address % HistoCollection<double>::alignment);
+    }
+    HistoCollection<double> copied(collection);
+    const auto address = reinterpret_cast<std::uintptr_t>(copied.CountsOf(0));
+    EXPECT_EQ(0, address % HistoCollection<double>::alignment);
+}
+
+TEST(HistoCollection, BatchOperationsMatchHisto){
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 20.0, 1.0);
+    vector<vector<double>> datas{{1.0, 1.0, 2.0, 3.0, 19.0},
+                                 {4.0, 4.5, 10.0},
+                                 {0.0, 20.0, 7.0, 7.0}};
+    HistoCollection<double> collection(breaks, datas.size());
+    vector<Histo<double>> histos;
+    for (size_t h = 0; h < datas.size(); h++) {
+        histos.emplace_back(datas[h], breaks);
+        collection.SetHistogram(h, histos[h]);
+    }
+    const auto means = collection.MeanAll();
+    const auto normalized = collection.NormalizeAllByArea();
+    for (size_t h = 0; h < datas.size(); h++) {
+        EXPECT_FLOAT_EQ(Mean(histos[h]), means[h]);
+        const auto expected = NormalizeByArea(histos[h]);
+        const auto view = normalized.View(h);
+        for (unsigned long int b = 0; b < collection.bins; b++) {
+            EXPECT_FLOAT_EQ(expected.counts[b], view.counts[b]);
+        }
+    }
+    const auto merged = collection.MergeAll();
+    Histo<double> expected_merged(datas[0], breaks);
+    expected_merged.FillCounts(datas[1]);
+    expected_merged.FillCounts(datas[2]);
+    EXPECT_EQ(expected_merged.counts, merged.counts);
+    EXPECT_EQ(breaks, merged.breaks);
+
+    Histo<double> other_breaks(datas[0], histo::GenerateBreaksFromRangeAndBins<double>(0.0, 20.0, 3));
+    EXPECT_THROW(collection.SetHistogram(0, other_breaks), histo_error);
+}
+
+#if __cplusplus >= 201703L
+TEST(HistoCollection, WithMemoryResource){
+    std::pmr::monotonic_buffer_resource arena(1 << 16);
+    using Alloc = std::pmr::polymorphic_allocator<unsigned long int>;
+    vector<double> data{1.0, 2.0, 3.0, 4.0};
+    vector<int> labels{0, 1, 0, 1};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 5.0, 1.0);
+    HistoCollection<double, unsigned long int, Alloc> collection(
+        data, labels, breaks, 2, 1, Alloc(&arena));
+    EXPECT_EQ(&arena, collection.counts.get_allocator().resource());
+    EXPECT_EQ(1, collection.View(1).counts[4]);
+    const auto normalized = collection.NormalizeAllByArea();
+    EXPECT_EQ(&arena, normalized.counts.get_allocator().resource());
+    HistoCollection<double, unsigned long int, Alloc> moved(breaks, 2);
+    moved = std::move(collection);
+    EXPECT_EQ(1, moved.View(1).counts[4]);
+    const auto address = reinterpret_cast<std::uintptr_t>(moved.CountsOf(1));
+    EXPECT_EQ(0, address % HistoCollection<double>::alignment);
+}
+#endif
@@ -0,0 +1,69 @@
+#include "gmock/gmock.h"
+#include "histo_distances.hpp"
+#include <memory>
+#include <iostream>
+#include <random>
+using namespace testing;
+using namespace std;
+using namespace histo;
+
+/**
+ * @brief p = {0.5, 0.5, 0}, q = {0, 0.5, 0.5}, with unit width bins.
+ */
+struct HistoDistances : public ::testing::Test{
+    static vector<double> breaks;
+    static Histo<double> p;
+    static Histo<double> q;
+};
+vector<double> HistoDistances::breaks{0.0, 1.0, 2.0, 3.0};
+Histo<double> HistoDistances::p(vector<double>{0.5, 1.5}, breaks);
+Histo<double> HistoDistances::q(vector<double>{1.5, 1.5, 2.5, 2.5}, breaks);
+
+TEST_F(HistoDistances, AreCorrect) {
+    EXPECT_DOUBLE_EQ(0.5, Distance(p, q, ChiSquareDistance));
+    EXPECT_DOUBLE_EQ(0.5, Distance(p, q, IntersectionDistance));
+    EXPECT_DOUBLE_EQ(std::log(2.0), Distance(p, q, BhattacharyyaDistance));
+    EXPECT_TRUE(std::isinf(Distance(p, q, KullbackLeiblerDivergence)));
+    EXPECT_DOUBLE_EQ(0.5 * std::log(2.0), Distance(p, q, JensenShannonDivergence));
+    EXPECT_DOUBLE_EQ(1.0, Distance(p, q, EarthMoversDistance));
+}
+
+TEST_F(HistoDistances, ToItselfIsZero) {
+    for (auto method : {ChiSquareDistance, IntersectionDistance, BhattacharyyaDistance,
+                        KullbackLeiblerDivergence, JensenShannonDivergence,
+                        EarthMoversDistance}) {
+        EXPECT_NEAR(0.0, Distance(p, p, method), 1e-12) << method;
+    }
+    Histo<double, unsigned long int, SparseCounts> q_sparse(vector<double>{1.5, 1.5, 2.5, 2.5}, breaks);
+    EXPECT_DOUBLE_EQ(0.0, Distance(q, q_sparse, ChiSquareDistance));
+    Histo<double> other(vector<double>{1.0}, vector<double>{0.0, 1.5, 3.0});
+    EXPECT_THROW(Distance(p, other, ChiSquareDistance), histo_error);
+}
+
+TEST(HistoDistancesBatch, MatchOneByOne) {
+    const unsigned long int number_of_histograms = 200;
+    auto breaks = histo::GenerateBreaksFromRangeAndBins<double>(0.0, 256.0, 256);
+    default_random_engine generator;
+    uniform_real_distribution<double> values_dist(0.0, 256.0);
+    HistoCollection<double> collection(breaks, number_of_histograms);
+    vector<Histo<double>> histos;
+    for (unsigned long int h = 0; h < number_of_histograms; h++) {
+        vector<double> data(1000);
+        for (auto &v : data) {
+            v = values_dist(generator) * (h + 1) / number_of_histograms;
+        }
+        histos.emplace_back(data, breaks);
+        collection.SetHistogram(h, histos.back());
+    }
+    const auto &query = histos[42];
+    for (auto method : {ChiSquareDistance, IntersectionDistance, BhattacharyyaDistance,
+                        JensenShannonDivergence, EarthMoversDistance}) {
+        const auto distances = Distances(query, collection, method, 4);
+        ASSERT_EQ(number_of_histograms, distances.size());
+        for (unsigned long int h = 0; h < number_of_histograms; h++) {
+            EXPECT_NEAR(Distance(query, histos[h], method), distances[h], 1e-9)
+                << method << " " << h;
+        }
+        EXPECT_NEAR(0.0, distances[42], 1e-12);
+    }
+}
@@ -0,0 +1,125 @@
+#include "gmock/gmock.h"
+#include "histo_equalize.hpp"
+#include <memory>
+#include <iostream>
+#include <random>
+#include <cmath>
+using namespace testing;
+using namespace std;
+using namespace histo;
+
+TEST(EqualizationLUT, FlattensTheCumulativeDistribution){
+    vector<double> data{0.5, 0.5, 0.5, 1.5, 2.5, 3.5};
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double> h(data, breaks);
+    auto lut = EqualizationLUT(h, 0.0, 255.0);
+    EXPECT_TRUE(lut.equidistant);
+    ASSERT_EQ(4, lut.table.size());
+    // cdf = {3, 4, 5, 6}, cdf_min = 3
+    EXPECT_DOUBLE_EQ(0.0, lut.table[0]);
+    EXPECT_DOUBLE_EQ(85.0, lut.table[1]);
+    EXPECT_DOUBLE_EQ(170.0, lut.table[2]);
+    EXPECT_DOUBLE_EQ(255.0, lut.table[3]);
+    EXPECT_DOUBLE_EQ(85.0, lut(1.2));
+    // Out of range is clamped.
+    EXPECT_DOUBLE_EQ(0.0, lut(-10.0));
+    EXPECT_DOUBLE_EQ(255.0, lut(10.0));
+}
+
+TEST(LookupTable, NonEquidistantBreaksUseBinarySearch){
+    LookupTable<double> lut(vector<double>{0.0, 1.0, 3.0, 10.0}, vector<double>{1.0, 2.0, 3.0});
+    EXPECT_FALSE(lut.equidistant);
+    EXPECT_DOUBLE_EQ(1.0, lut(-1.0));
+    EXPECT_DOUBLE_EQ(1.0, lut(0.5));
+    EXPECT_DOUBLE_EQ(2.0, lut(1.0));
+    EXPECT_DOUBLE_EQ(3.0, lut(3.0));
+    EXPECT_DOUBLE_EQ(3.0, lut(10.0));
+    EXPECT_DOUBLE_EQ(3.0, lut(100.0));
+    EXPECT_THROW(LookupTable<double>(vector<double>{0.0, 1.0}, vector<double>{1.0, 2.0}), histo_error);
+}
+
+TEST(LookupTable, ValuesOnBreaksMatchIndexFromValue){
+    // Widths not representable in binary, so (value - low) / width rounds.
+    for (const auto &range : vector<pair<double, double>>{{0.0, 1.0}, {-0.3, 0.7}, {0.1, 7.3}}) {
+        for (const unsigned long int bins : {3ul, 10ul, 49ul, 100ul}) {
+            const auto breaks = GenerateBreaksFromRangeAndBins<double>(range.first, range.second, bins);
+            Histo<double> h(vector<double>{range.first}, breaks);
+            LookupTable<double> lut(breaks, vector<double>(bins, 0.0));
+            ASSERT_TRUE(lut.equidistant);
+            for (const auto &b : breaks) {
+                EXPECT_EQ(h.IndexFromValue(b), lut.Index(b)) << b;
+                const double below = std::nextafter(b, range.first - 1.0);
+                const double above = std::nextafter(b, range.second + 1.0);
+                if (below >= range.first) {
+                    EXPECT_EQ(h.IndexFromValue(below), lut.Index(below)) << below;
+                }
+                if (above < range.second) {
+                    EXPECT_EQ(h.IndexFromValue(above), lut.Index(above)) << above;
+                }
+            }
+            EXPECT_EQ(bins - 1, lut.Index(range.second));
+        }
+    }
+}
+
+TEST(MatchingLUT, MapsToReferenceQuantiles){
+    auto breaks = histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0);
+    Histo<double> source(vector<double>{0.5, 1.5, 2.5, 3.5}, breaks);
+    auto reference_breaks = histo::GenerateBreaksFromRangeAndWidth<double>(10.0, 12.0, 1.0);
+    Histo<double> reference(vector<double>{10.5, 11.5}, reference_breaks);
+    auto lut = MatchingLUT(source, reference);
+    // Source cdf = {0.25, 0.5, 0.75, 1}, reference is uniform in [10, 12].
+    EXPECT_DOUBLE_EQ(10.5, lut.table[0]);
+    EXPECT_DOUBLE_EQ(11.0, lut.table[1]);
+    EXPECT_DOUBLE_EQ(11.5, lut.table[2]);
+    EXPECT_DOUBLE_EQ(12.0, lut.table[3]);
+    Histo<double> empty(vector<double>{}, reference_breaks);
+    EXPECT_THROW(MatchingLUT(source, empty), histo_error);
+}
+
+TEST(ApplyLUT, IntegralDataUsesDirectTable){
+    default_random_engine generator;
+    uniform_int_distribution<int> dist(0, 255);
+    vector<unsigned char> image(100001);
+    for (auto &v : image) {
+        v = static_cast<unsigned char>(dist(generator) / 2);
+    }
+    Histo<double> h(image, histo::GenerateBreaksFromRangeAndBins<double>(-0.5, 255.5, 256));
+    auto lut = EqualizationLUT(h, 0.0, 255.0);
+    auto expected = image;
+    for (auto &v : expected) {
+        v = ConvertLookupOutput<unsigned char>(lut(v));
+    }
+    ApplyLUT(lut, image, 4);
+    EXPECT_EQ(expected, image);
+    EXPECT_EQ(255, *std::max_element(image.begin(), image.end()));
+}
+
+TEST(ApplyLUT, IntegralDataClampsLikeLUT){
+    // First and last bins hold no integer: [0.25, 0.5), [2, 2.25].
+    LookupTable<double> lut(histo::GenerateBreaksFromRangeAndBins<double>(0.25, 2.25, 8),
+                            vector<double>{10, 20, 30, 40, 50, 60, 70, 80});
+    vector<int> data{-5, 0, 1, 2, 3, 100};
+    auto expected = data;
+    for (auto &v : expected) {
+        v = ConvertLookupOutput<int>(lut(v));
+    }
+    EXPECT_EQ(10, expected[0]);
+    EXPECT_EQ(10, expected[1]);
+    EXPECT_EQ(80, expected[5]);
+    auto direct = data;
+    ApplyLUT(lut, direct, 2);
+    EXPECT_EQ(expected, direct);
+    // Without direct table, through LookupTable::operator().
+    ApplyLUT(lut, data.data(), data.size(), 2, 0);
+    EXPECT_EQ(expected, data);
+}
+
+TEST(ApplyLUT, FloatingDataMatchesLUT){
+    vector<double> data{0.5, 1.5, 2.5, 3.5, -1.0, 7.0, 1.0};
+    auto lut = LookupTable<double>(histo::GenerateBreaksFromRangeAndWidth<double>(0.0, 4.0, 1.0),
+                                   vector<double>{10.0, 20.0, 30.0, 40.0});
+    ApplyLUT(lut, data, 3);
+    vector<double> expected{10.0, 20.0, 30.0, 40.0, 10.0, 40.0, 20.0};
+    EXPECT_EQ(expected, data);
+}
@@ -0,0 +1,76 @@
+#include "gmock/gmock.h"
+#include "histo.hpp"
+#include "histo_collection.hpp"
+#include "histo_equalize.hpp"
+#include "histo_parallel_fill.hpp"
+#include <memory>
+#include <iostream>
+#include <sstream>
+#include <random>
+using namespace testing;
+using namespace std;
+using namespace histo;
+
+TEST(FillStats, RecordsPhasesAndSamples){
+    ResetFillStats();
+    vector<double> data{1.0, 1.0, 2.0, 3.0, 19.0};
+    Histo<double> h(data);
+    auto stats = GetFillStats();
+    EXPECT_TRUE(stats.enabled);
+    EXPECT_EQ(1, stats.phase_calls[MinMaxPhase]);
+    EXPECT_EQ(1, stats.phase_calls[VariancePhase]);
+    EXPECT_EQ(1, stats.phase_calls[BalanceBreaksPhase]);
+    EXPECT_EQ(1, stats.phase_calls[FillCountsPhase]);
+    EXPECT_EQ(5, stats.samples);
+    EXPECT_EQ(5, stats.index_path_samples[SearchIndexPath]);
+    EXPECT_GE(stats.phase_seconds[FillCountsPhase], 0.0);
+
+    EXPECT_THROW(h.FillCounts(vector<double>{-1.0}), histo_error);
+    EXPECT_THROW(h.FillCounts(vector<double>{std::nan("")}), histo_error);
+    stats = GetFillStats();
+    EXPECT_EQ(1, stats.out_of_range);
+    EXPECT_EQ(1, stats.nan);
+
+    ResetFillStats();
+    EXPECT_EQ(0, GetFillStats().samples);
+}
+
+TEST(FillStats, RecordsIndexPathsAndThreads){
+    ResetFillStats();
+    vector<unsigned char> image(10000, 3);
+    Histo<double> h(image, histo::GenerateBreaksFromRangeAndBins<double>(-0.5, 255.5, 256));
+    auto lut = EqualizationLUT(h, 0.0, 255.0);
+    ApplyLUT(lut, image, 2);
+    vector<double> values(100, 1.5);
+    ApplyLUT(lut, values, 2);
+    vector<int> labels(image.size(), 0);
+    HistoCollection<double> collection(image, labels, h.breaks, 1, 2);
+    auto stats = GetFillStats();
+    EXPECT_EQ(10000, stats.index_path_samples[LUTIndexPath]);
+    EXPECT_EQ(100, stats.index_path_samples[UniformIndexPath]);
+    EXPECT_EQ(2, stats.phase_calls[ApplyLUTPhase]);
+    EXPECT_EQ(1, stats.phase_calls[GroupedFillPhase]);
+    EXPECT_GE(stats.parallel_regions, 3);
+    EXPECT_GE(stats.parallel_threads, 6);
+    EXPECT_GT(stats.ThreadUtilization(), 0.0);
+    EXPECT_LE(stats.ThreadUtilization(), 1.0);
+
+    std::ostringstream os;
+    stats.PrintJSON(os);
+    EXPECT_THAT(os.str(), HasSubstr("\"enabled\": true"));
+    EXPECT_THAT(os.str(), HasSubstr("\"lut\": 10000"));
+    EXPECT_THAT(os.str(), HasSubstr("\"apply_lut\": {\"seconds\": "));
+}
+
+TEST(FillStats, MaskedFillsCountSelectedSamples){
+    ResetFillStats();
+    vector<double> data(1000, 1.5);
+    const IndexRanges ranges{{0, 100}, {500, 550}};
+    Histo<double> h(vector<double>(), histo::GenerateBreaksFromRangeAndBins<double>(0.0, 2.0, 2));
+    h.FillCountsMasked(data, ranges);
+    FillCountsParallelMasked(h, data, ranges, 3);
+    auto stats = GetFillStats();
+    EXPECT_EQ(300, stats.samples);
+    EXPECT_EQ(1, stats.phase_calls[ParallelFillPhase]);
+    EXPECT_EQ(300, h.counts[1]);
+}
@@ -0,0 +1,176 @@
+#include "gmock/gmock.h"
+#include "histo_parallel_fill.hpp"
+#include <memory>
+#include <iostream>
+#include <random>
+using namespace testing;
+using namespace std;
+using namespace histo;
+
+namespace {
+vector<double> RandomNormal(const size_t &n) {
+    std::mt19937 gen(42);
+    std::normal_distribution<double> dist(50.0, 10.0);
+    vector<double> data(n);
+    for (auto &v : data)
+        v = std::min(std::max(dist(gen), 0.0), 99.9);
+    return data;
+}
+} // namespace
+
+TEST(NumaTopology, DetectsAtLeastOneNodeWithCpus){
+    const auto topology = DetectNumaTopology();
+    ASSERT_GE(topology.Nodes(), 1);
+    for (const auto &node : topology.node_cpus) {
+        EXPECT_FALSE(node.empty());
+    }
+    EXPECT_EQ(1, topology.FirstNodes(1).Nodes());
+    EXPECT_EQ(topology.Cpus(), AllowedCpus().size());
+}
+
+TEST(NumaTopology, ThreadsAreSpreadInBlocks){
+    NumaTopology topology;
+    topology.node_cpus = {{0, 1}, {2, 3}};
+    EXPECT_THAT(ThreadNodes(topology, 4), ElementsAre(0, 0, 1, 1));
+    EXPECT_THAT(ThreadNodes(topology, 3), ElementsAre(0, 1, 1));
+    EXPECT_THAT(ThreadNodes(topology, 1), ElementsAre(1));
+    EXPECT_THAT(ThreadCpus(topology, ThreadNodes(topology, 6)),
+                ElementsAre(0, 1, 0, 2, 3, 2));
+}
+
+TEST(PageAlignedChunks, BoundariesAreAtPages){
+    const size_t n = 100000;
+    vector<double> data(n);
+    const auto boundaries = PageAlignedChunks(data.data(), n, 7);
+    ASSERT_EQ(8, boundaries.size());
+    EXPECT_EQ(0, boundaries.front());
+    EXPECT_EQ(n, boundaries.back());
+    const auto page = PageSize();
+    for (size_t c = 1; c + 1 < boundaries.size(); ++c) {
+        EXPECT_LE(boundaries[c - 1], boundaries[c]);
+        if (boundaries[c] < n) {
+            const auto address =
+                    reinterpret_cast<std::uintptr_t>(data.data() + boundaries[c]);
+            EXPECT_EQ(0, address % page);
+        }
+    }
+    // More chunks than pages.
+    const auto few = PageAlignedChunks(data.data(), 10, 4);
+    EXPECT_EQ(0, few.front());
+    EXPECT_EQ(10, few.back());
+}
+
+TEST(FillCountsParallel, MatchesSerialFill){
+    const auto data = RandomNormal(200001);
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 97);
+    Histo<double> h_serial(data, breaks);
+    for (const unsigned int threads : {1u, 3u, 8u}) {
+        Histo<double> h_parallel(vector<double>(), breaks);
+        FillCountsParallel(h_parallel, data, threads);
+        EXPECT_EQ(h_serial.counts, h_parallel.counts) << threads;
+    }
+    // Counts are added to.
+    Histo<double> h_twice(data, breaks);
+    FillCountsParallel(h_twice, data, 4);
+    for (size_t i = 0; i < h_twice.bins; ++i) {
+        EXPECT_EQ(2 * h_serial.counts[i], h_twice.counts[i]);
+    }
+}
+
+TEST(FillCountsParallel, HierarchicalReductionOverFakeNodes){
+    const auto data = RandomNormal(50000);
+    // Non equidistant breaks.
+    vector<double> breaks{0.0, 10.0, 40.0, 45.0, 50.0, 52.0, 60.0, 100.0};
+    Histo<double> h_serial(data, breaks);
+    // Three nodes sharing the same cpus, as with fake NUMA.
+    const auto allowed = AllowedCpus();
+    NumaTopology fake;
+    fake.node_cpus = {allowed, allowed, allowed};
+    Histo<double> h_parallel(vector<double>(), breaks);
+    FillCountsParallel(h_parallel, data.data(), data.size(), 7, fake);
+    EXPECT_EQ(h_serial.counts, h_parallel.counts);
+}
+
+TEST(FillCountsParallel, OtherStorages){
+    const auto data = RandomNormal(30000);
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 1000);
+    Histo<double> h_serial(data, breaks);
+    Histo<double, unsigned long int, SparseCounts> h_sparse(vector<double>(), breaks);
+    FillCountsParallel(h_sparse, data, 4);
+    Histo<double, unsigned long int, AdaptiveCounts> h_adaptive(vector<double>(), breaks);
+    FillCountsParallel(h_adaptive, data, 4);
+    for (size_t i = 0; i < h_serial.bins; ++i) {
+        EXPECT_EQ(h_serial.counts[i], h_sparse.counts[i]);
+        EXPECT_EQ(h_serial.counts[i], h_adaptive.counts[i]);
+    }
+}
+
+TEST(FillCountsParallel, SparseStorageStaysSparse){
+    const auto data = RandomNormal(3000);
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 10000000);
+    Histo<double, unsigned long int, SparseCounts> h_sparse(vector<double>(), breaks);
+    FillCountsParallel(h_sparse, data, 4);
+    EXPECT_FALSE(h_sparse.counts.is_dense());
+    EXPECT_LE(h_sparse.counts.occupied(), data.size());
+    Histo<double, unsigned long int, SparseCounts> h_masked(vector<double>(), breaks);
+    FillCountsParallelMasked(h_masked, data, IndexRanges{{0, 1000}, {2000, 3000}}, 4);
+    EXPECT_FALSE(h_masked.counts.is_dense());
+    unsigned long int total = 0;
+    h_sparse.counts.for_each_occupied(
+            [&](const size_t &, const unsigned long int &c) { total += c; });
+    EXPECT_EQ(data.size(), total);
+}
+
+TEST(FillCountsParallel, ThrowsOutOfRangeAndKeepsCounts){
+    auto data = RandomNormal(10000);
+    data[7777] = 200.0;
+    Histo<double> h(vector<double>(), GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 10));
+    EXPECT_ANY_THROW(FillCountsParallel(h, data, 4));
+    EXPECT_THAT(h.counts, Each(0));
+}
+
+TEST(FillCountsParallel, GrowingAxisIsFilledSerially){
+    const vector<double> data{-5.0, 0.5, 1.5, 30.0};
+    Histo<double> h(vector<double>(), GenerateBreaksFromRangeAndBins<double>(0.0, 2.0, 2));
+    h.SetAxisGrowth(GrowingAxis);
+    FillCountsParallel(h, data, 4);
+    unsigned long int total = 0;
+    for (const auto &c : h.counts)
+        total += c;
+    EXPECT_EQ(data.size(), total);
+    EXPECT_LE(h.breaks.front(), -5.0);
+    EXPECT_GT(h.breaks.back(), 30.0);
+}
+
+TEST(FillCountsParallelMasked, MatchesSerialMaskedFill){
+    auto data = RandomNormal(100003);
+    vector<unsigned char> byte_mask(data.size());
+    vector<std::uint64_t> words((data.size() + 63) / 64, 0);
+    for (size_t i = 0; i < data.size(); ++i) {
+        byte_mask[i] = (i % 3 == 0 || (i > 5000 && i < 9000)) ? 1 : 0;
+        if (byte_mask[i])
+            words[i / 64] |= std::uint64_t(1) << (i % 64);
+        else
+            data[i] = -1.0; // out of range, must not be read.
+    }
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 64);
+    Histo<double> h_serial(vector<double>(), breaks);
+    h_serial.FillCountsMasked(data, byte_mask);
+    for (const unsigned int threads : {1u, 5u}) {
+        Histo<double> h_byte(vector<double>(), breaks);
+        FillCountsParallelMasked(h_byte, data, byte_mask, threads);
+        EXPECT_EQ(h_serial.counts, h_byte.counts) << threads;
+        Histo<double> h_bit(vector<double>(), breaks);
+        FillCountsParallelMasked(h_bit, data.data(), data.size(),
+                                 BitMask{words.data()}, threads);
+        EXPECT_EQ(h_serial.counts, h_bit.counts) << threads;
+    }
+    const IndexRanges ranges{{0, 1}, {5001, 9000}, {90000, 90001}};
+    Histo<double> h_ranges_serial(vector<double>(), breaks);
+    h_ranges_serial.FillCountsMasked(data, ranges);
+    Histo<double> h_ranges(vector<double>(), breaks);
+    FillCountsParallelMasked(h_ranges, data, ranges, 4);
+    EXPECT_EQ(h_ranges_serial.counts, h_ranges.counts);
+    EXPECT_ANY_THROW(FillCountsParallelMasked(h_ranges, data,
+                                              IndexRanges{{0, data.size() + 1}}, 4));
+}
@@ -0,0 +1,225 @@
+#include "gmock/gmock.h"
+#include "histo_pipeline.hpp"
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <iostream>
+#include <random>
+using namespace testing;
+using namespace std;
+using namespace histo;
+
+namespace {
+vector<double> RandomUniform(const size_t &n, const unsigned int &seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> dist(0.0, 100.0);
+    vector<double> data(n);
+    for (auto &v : data)
+        v = dist(gen);
+    return data;
+}
+
+void WriteRaw(const string &path, const vector<double> &data) {
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    std::fwrite(data.data(), sizeof(double), data.size(), file);
+    std::fclose(file);
+}
+
+#ifdef HISTO_WITH_ZLIB
+void WriteGzip(const string &path, const vector<double> &data) {
+    gzFile file = gzopen(path.c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(static_cast<int>(data.size() * sizeof(double)),
+              gzwrite(file, data.data(),
+                      static_cast<unsigned int>(data.size() * sizeof(double))));
+    gzclose(file);
+}
+#endif
+
+#ifdef HISTO_WITH_ZSTD
+// Two frames, the source must continue after the end of a frame.
+void WriteZstd(const string &path, const vector<double> &data) {
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    const size_t half = data.size() / 2;
+    for (const auto &frame : {make_pair(size_t(0), half),
+                              make_pair(half, data.size())}) {
+        const size_t bytes = (frame.second - frame.first) * sizeof(double);
+        vector<char> compressed(ZSTD_compressBound(bytes));
+        const size_t size = ZSTD_compress(compressed.data(), compressed.size(),
+                                          data.data() + frame.first, bytes, 1);
+        ASSERT_FALSE(ZSTD_isError(size));
+        std::fwrite(compressed.data(), 1, size, file);
+    }
+    std::fclose(file);
+}
+#endif
+} // namespace
+
+TEST(FillCountsFromFiles, RawFilesMatchFillCounts){
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 50);
+    vector<string> paths;
+    Histo<double> h_expected(vector<double>(), breaks);
+    for (unsigned int f = 0; f < 3; ++f) {
+        const auto data = RandomUniform(10000 + 7 * f, f);
+        paths.push_back("test_histo_pipeline_raw_" + to_string(f) + ".bin");
+        WriteRaw(paths.back(), data);
+        h_expected.FillCounts(data);
+    }
+    // Small blocks and few buffers, so buffers are reused many times.
+    for (const unsigned int decompress_threads : {1u, 2u, 4u}) {
+        Histo<double> h(vector<double>(), breaks);
+        FillCountsFromFiles<double>(h, paths, NoCompression,
+                                    decompress_threads, 3, 1000, 2);
+        EXPECT_EQ(h_expected.counts, h.counts) << decompress_threads;
+    }
+    Histo<double> h_default(vector<double>(), breaks);
+    FillCountsFromFiles<double>(h_default, paths, NoCompression);
+    EXPECT_EQ(h_expected.counts, h_default.counts);
+    for (const auto &path : paths)
+        std::remove(path.c_str());
+}
+
+TEST(FillCountsFromFiles, ValuesOnBreaksMatchFillCounts){
+    // Width 0.1 is not representable, the uniform index must not round.
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(-0.3, 0.7, 10);
+    vector<double> data;
+    for (const auto &b : breaks) {
+        data.push_back(b);
+        if (b > breaks.front())
+            data.push_back(std::nextafter(b, -1.0));
+        if (b < breaks.back())
+            data.push_back(std::nextafter(b, 1.0));
+    }
+    Histo<double> h_expected(data, breaks);
+    const string path = "test_histo_pipeline_breaks.bin";
+    WriteRaw(path, data);
+    Histo<double> h(vector<double>(), breaks);
+    FillCountsFromFiles<double>(h, {path}, NoCompression, 1, 2, 64);
+    EXPECT_EQ(h_expected.counts, h.counts);
+    std::remove(path.c_str());
+}
+
+TEST(FillCountsFromFiles, SparseStorageStaysSparse){
+    const auto data = RandomUniform(3000, 7);
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 10000000);
+    const string path = "test_histo_pipeline_sparse.bin";
+    WriteRaw(path, data);
+    Histo<double, unsigned long int, SparseCounts> h(vector<double>(), breaks);
+    FillCountsFromFiles<double>(h, {path}, NoCompression, 1, 4, 1000, 2);
+    EXPECT_FALSE(h.counts.is_dense());
+    Histo<double, unsigned long int, SparseCounts> h_expected(data, breaks);
+    auto total = [&h, &h_expected]() {
+        unsigned long int sum = 0;
+        h.counts.for_each_occupied([&](const size_t &i, const unsigned long int &c) {
+            EXPECT_EQ(h_expected.counts[i], c) << i;
+            sum += c;
+        });
+        return sum;
+    };
+    EXPECT_EQ(data.size(), total());
+
+    // An error leaves the counts unchanged.
+    auto bad = data;
+    bad[2500] = 1000.0;
+    WriteRaw(path, bad);
+    EXPECT_ANY_THROW(FillCountsFromFiles<double>(h, {path}, NoCompression, 1, 1, 800, 2));
+    EXPECT_EQ(data.size(), total());
+    std::remove(path.c_str());
+}
+
+TEST(FillCountsFromFiles, ErrorsStopThePipeline){
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 10);
+    Histo<double> h(vector<double>(), breaks);
+    EXPECT_ANY_THROW(FillCountsFromFiles<double>(
+            h, {"test_histo_pipeline_missing.bin"}, NoCompression));
+
+    auto data = RandomUniform(5000, 1);
+    data[4321] = 1000.0;
+    const string out_of_range = "test_histo_pipeline_out_of_range.bin";
+    WriteRaw(out_of_range, data);
+    EXPECT_ANY_THROW(FillCountsFromFiles<double>(h, {out_of_range},
+                                                 NoCompression, 1, 2, 800, 2));
+    std::remove(out_of_range.c_str());
+
+    // Size not multiple of sizeof(double).
+    const string truncated = "test_histo_pipeline_truncated.bin";
+    std::FILE *file = std::fopen(truncated.c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    std::fwrite(data.data(), 1, 8 * 100 + 3, file);
+    std::fclose(file);
+    EXPECT_ANY_THROW(FillCountsFromFiles<double>(h, {truncated}, NoCompression));
+    std::remove(truncated.c_str());
+#ifndef HISTO_WITH_ZSTD
+    EXPECT_ANY_THROW(FillCountsFromFiles<double>(h, {truncated}, ZstdCompression));
+#endif
+}
+
+TEST(FillCountsFromFiles, GrowingAxis){
+    const vector<double> data{-5.0, 0.5, 1.5, 30.0, 2.5};
+    const string path = "test_histo_pipeline_growing.bin";
+    WriteRaw(path, data);
+    Histo<double> h(vector<double>(), GenerateBreaksFromRangeAndBins<double>(0.0, 2.0, 2));
+    h.SetAxisGrowth(GrowingAxis);
+    FillCountsFromFiles<double>(h, {path}, NoCompression, 1, 4, 16);
+    unsigned long int total = 0;
+    for (const auto &c : h.counts)
+        total += c;
+    EXPECT_EQ(data.size(), total);
+    EXPECT_LE(h.breaks.front(), -5.0);
+    EXPECT_GT(h.breaks.back(), 30.0);
+    std::remove(path.c_str());
+}
+
+#ifdef HISTO_WITH_ZLIB
+TEST(FillCountsFromFiles, GzipFilesMatchFillCounts){
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 64);
+    vector<string> paths;
+    Histo<double> h_expected(vector<double>(), breaks);
+    for (unsigned int f = 0; f < 2; ++f) {
+        const auto data = RandomUniform(200000, 10 + f);
+        paths.push_back("test_histo_pipeline_" + to_string(f) + ".gz");
+        WriteGzip(paths.back(), data);
+        h_expected.FillCounts(data);
+    }
+    Histo<double> h(vector<double>(), breaks);
+    FillCountsFromFiles<double>(h, paths, GzipCompression, 2, 2, 1 << 14, 4);
+    EXPECT_EQ(h_expected.counts, h.counts);
+    for (const auto &path : paths)
+        std::remove(path.c_str());
+}
+#endif
+
+#ifdef HISTO_WITH_ZSTD
+TEST(FillCountsFromFiles, ZstdFilesMatchFillCounts){
+    const auto breaks = GenerateBreaksFromRangeAndBins<double>(0.0, 100.0, 64);
+    vector<string> paths;
+    Histo<double> h_expected(vector<double>(), breaks);
+    for (unsigned int f = 0; f < 2; ++f) {
+        const auto data = RandomUniform(200000 + 3 * f, 20 + f);
+        paths.push_back("test_histo_pipeline_" + to_string(f) + ".zst");
+        WriteZstd(paths.back(), data);
+        h_expected.FillCounts(data);
+    }
+    Histo<double> h(vector<double>(), breaks);
+    FillCountsFromFiles<double>(h, paths, ZstdCompression, 2, 2, 1 << 14, 4);
+    EXPECT_EQ(h_expected.counts, h.counts);
+
+    // Truncated frame.
+    std::FILE *file = std::fopen(paths[0].c_str(), "rb");
+    ASSERT_NE(nullptr, file);
+    vector<char> bytes(1 << 16);
+    bytes.resize(std::fread(bytes.data(), 1, bytes.size(), file));
+    std::fclose(file);
+    file = std::fopen(paths[0].c_str(), "wb");
+    ASSERT_NE(nullptr, file);
+    std::fwrite(bytes.data(), 1, bytes.size() / 3, file);
+    std::fclose(file);
+    Histo<double> h_truncated(vector<double>(), breaks);
+    EXPECT_ANY_THROW(FillCountsFromFiles<double>(h_truncated, {paths[0]},
+                                                 ZstdCompression));
+    for (const auto &path : paths)
+        std::remove(path.c_str());
+}
+#endif
@@ -1,5 +1,6 @@
 #include "gmock/gmock.h"
 #include "visualize_histo.hpp"
+#include <algorithm>
 #include <memory>
 #include <iostream>
 #include <random>
@@ -16,3 +17,50 @@ TEST(VisualizeHisto, withJustData){
     visualize_histo(h);
     visualize_histo(h, vtkChart::BAR);
 }
+
+TEST(VisualizeHisto, HistoChartWrapsCountsWithoutCopy){
+    vector<double> data{0.0, 1.0, 1.0,1.0, 2.0, 3.0, 5.0, 5.0, 8.0, 8.0,  12.0};
+    Histo<double> h(data, histo::GenerateBreaksFromRangeAndBins<double>(0.0,15.0, 5));
+    HistoChart<Histo<double>> histo_chart(h);
+    auto counts_array = vtkAOSDataArrayTemplate<unsigned long int>::SafeDownCast(
+            histo_chart.GetChart()->GetPlot(0)->GetInput()->GetColumn(1));
+    ASSERT_NE(nullptr, counts_array);
+    EXPECT_EQ(h.counts.data(), counts_array->GetPointer(0));
+    h.FillCounts(vector<double>{14.0});
+    histo_chart.Update();
+    EXPECT_EQ(2, counts_array->GetValue(4));
+}
+
+TEST(VisualizeHisto, HistoChartUpdatesCentersWhenBreaksChange){
+    // Merge and extend keep the number of bins and the first break.
+    Histo<double> h(vector<double>{0.5, 5.5}, histo::GenerateBreaksFromRangeAndBins<double>(0.0, 6.0, 6));
+    h.SetAxisGrowth(GrowingAxis, 6);
+    HistoChart<Histo<double>> histo_chart(h);
+    auto centers_array = vtkAOSDataArrayTemplate<double>::SafeDownCast(
+            histo_chart.GetChart()->GetPlot(0)->GetInput()->GetColumn(0));
+    ASSERT_NE(nullptr, centers_array);
+    EXPECT_DOUBLE_EQ(0.5, centers_array->GetValue(0));
+    h.FillCounts(vector<double>{7.0});
+    ASSERT_EQ(7, h.breaks.size());
+    ASSERT_DOUBLE_EQ(0.0, h.breaks.front());
+    histo_chart.Update();
+    const auto expected = h.ComputeBinCenters();
+    ASSERT_EQ(expected.size(), centers_array->GetNumberOfValues());
+    for (size_t i = 0; i < expected.size(); ++i)
+        EXPECT_DOUBLE_EQ(expected[i], centers_array->GetValue(i));
+    EXPECT_DOUBLE_EQ(1.0, centers_array->GetValue(0));
+}
+
+TEST(VisualizeHisto, RenderOffscreenToPNG){
+    vector<double> data{0.0, 1.0, 1.0,1.0, 2.0, 3.0, 5.0, 5.0, 8.0, 8.0,  12.0};
+    Histo<double> h(data, histo::GenerateBreaksFromRangeAndBins<double>(0.0,15.0, 5));
+    h.name = "offscreen";
+    HistoPNGRenderer renderer(320, 240);
+    for (size_t i = 0; i < 3; i++) {
+        auto png = renderer.Render(h, vtkChart::BAR);
+        ASSERT_GT(png.size(), 8);
+        const unsigned char signature[] = {0x89, 'P', 'N', 'G'};
+        EXPECT_TRUE(std::equal(signature, signature + 4, png.begin()));
+    }
+    EXPECT_FALSE(render_histo_to_png(h).empty());
+}